@@ -0,0 +1,118 @@
+#!/bin/bash
+
+# Runs the meshes in parallel, one process per mesh, and compares the time, peak memory, iterations and removed defects of each one
+# with a baseline file. Fails if a run crashes, or if a mesh is slower, uses more memory, or removes less defects than in the baseline
+# beyond the tolerances. The baseline is written when it doesn't exist, or when UPDATE_BASELINE=1
+#
+# Usage: bash regression.sh {executable path} [baseline file] [extra parameters]
+#
+# Environment:
+#   MODELS            meshes to run (defaults to all the mambo meshes)
+#   JOBS              number of meshes run at the same time (defaults to the number of cores)
+#   TIME_TOLERANCE    relative increase of time allowed (defaults to 0.3)
+#   MIN_TIME          differences of time below this many seconds are ignored (defaults to 0.1)
+#   MEMORY_TOLERANCE  relative increase of peak memory allowed (defaults to 0.2)
+#   DEFECT_TOLERANCE  number of removed defects that can be lost (defaults to 0)
+
+execPath=$1
+baseline=${2:-regression_baseline.txt}
+extraParams=$3
+
+models=${MODELS:-"meshes/mambo/Basic/*.mesh meshes/mambo/Simple/*.mesh meshes/mambo/Medium/*.mesh"}
+jobs=${JOBS:-$(getconf _NPROCESSORS_ONLN)}
+outputDir=output/regression
+
+if [ ! -x "$execPath" ]; then
+    echo "Usage: bash regression.sh {executable path} [baseline file] [extra parameters]"
+    exit 1
+fi
+
+mkdir -p $outputDir
+results=$(mktemp)
+
+run_model() {
+    model="$1"
+    name=$(echo "$model" | tr '/' '_')
+    report="$outputDir/$name.json"
+    rm -f "$report"
+
+    $execPath model=$model result_path=$outputDir/ report=$report $extraParams > "$outputDir/$name.log" 2>&1
+
+    # the report is only written at the end of a successful run
+    run=$(sed -n 's/.*"run": {"seconds": \([^,]*\), "iterations": \([0-9]*\), "peak memory kb": \([0-9]*\)}.*/\1 \2 \3/p' "$report" 2>/dev/null)
+    defects=$(sed -n 's/.*"defects": {"before": \([0-9]*\), "after": \([0-9]*\)}.*/\1 \2/p' "$report" 2>/dev/null)
+    if [ -z "$run" ] || [ -z "$defects" ]; then
+        echo "$model failed"
+        return
+    fi
+    echo "$model $run $defects" | awk '{ print $1, $2, $4, $3, $5-$6, $5 }'
+}
+
+export -f run_model
+export execPath extraParams outputDir
+
+start_time=$(date +%s)
+ls $models | xargs -P "$jobs" -I{} bash -c 'run_model {}' | sort > $results
+end_time=$(date +%s)
+echo "Ran $(wc -l < $results | tr -d ' ') meshes on $jobs jobs in $((end_time - start_time)) seconds"
+
+if [ ! -f "$baseline" ] || [ "$UPDATE_BASELINE" = "1" ]; then
+    { echo "# model seconds peak_memory_kb iterations removed_defects defects"; grep -v " failed$" $results; } > "$baseline"
+    echo "Baseline written in $baseline"
+    failed=$(grep " failed$" $results)
+    rm -f $results
+    if [ -n "$failed" ]; then
+        echo "$failed"
+        exit 1
+    fi
+    exit 0
+fi
+
+awk -v timeTolerance=${TIME_TOLERANCE:-0.3} -v minTime=${MIN_TIME:-0.1} -v memoryTolerance=${MEMORY_TOLERANCE:-0.2} -v defectTolerance=${DEFECT_TOLERANCE:-0} '
+    NR == FNR {
+        if ($1 !~ /^#/)
+            base[$1] = $0
+        next
+    }
+    {
+        model = $1
+        if ($2 == "failed") {
+            printf "%-40s FAILED, see the log in output/regression\n", model
+            failures++
+            next
+        }
+        if (!(model in base)) {
+            printf "%-40s new mesh, not in the baseline\n", model
+            next
+        }
+        split(base[model], b, " ")
+
+        problems = ""
+        if ($2 - b[2] > minTime && $2 > b[2]*(1 + timeTolerance))
+            problems = problems " time"
+        if ($3 > b[3]*(1 + memoryTolerance))
+            problems = problems " memory"
+        if ($5 < b[5] - defectTolerance)
+            problems = problems " defects"
+        if (problems != "")
+            failures++
+
+        printf "%-40s %8.2fs (%8.2fs) %9dkb (%9dkb) %5d iterations (%5d) %5d/%d removed defects (%5d)%s\n", model, $2, b[2], $3, b[3], $4, b[4], $5, $6, b[5], problems == "" ? "" : "  REGRESSION:" problems
+        total += $2
+        baseTotal += b[2]
+        removed += $5
+        baseRemoved += b[5]
+    }
+    END {
+        printf "\nTotal: %.2fs (%.2fs in the baseline), %d removed defects (%d in the baseline)\n", total, baseTotal, removed, baseRemoved
+        if (failures > 0) {
+            printf "%d meshes regressed or failed\n", failures
+            exit 1
+        }
+        print "No regression"
+    }
+' "$baseline" $results
+status=$?
+
+rm -f $results
+exit $status
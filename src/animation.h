@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <ultimaille/all.h>
+#include "writer.h"
+
+using namespace UM;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Replacing facets
+
+inline void replaceFacets(Quads& m, const std::vector<bool>& toKill, const std::vector<vec3>& points, const std::vector<int>& newQuads){
+    // Adds the points, deletes the facets to kill, adds the new quads, and deletes the vertices left without facets. The remeshing commits its
+    // patches with it, and the animation log replays it, so the ids of the vertices and facets are the same in both
+    int offset = m.nverts();
+    m.points.create_points(points.size());
+    for (int i=0; i<(int)points.size(); i++)
+        m.points[offset + i] = points[i];
+
+    m.delete_facets(toKill);
+
+    offset = m.nfacets();
+    m.create_facets(newQuads.size()/4);
+    std::copy(newQuads.begin(), newQuads.end(), m.facets.begin() + 4*offset);
+
+    m.delete_isolated_vertices();
+}
+
+inline void replaceFacetsInPlace(Quads& m, const std::vector<int>& killed, const std::vector<vec3>& points, const std::vector<int>& newQuads){
+    // Same as replaceFacets on a connected mesh, without compacting it: the killed facets are deactivated and taken out of the lists of
+    // corners around their vertices, and the new quads are connected as they are created, so it costs the size of the patch. The killed
+    // facets, and the vertices they leave without facets, stay in m until m.compact()
+    int offset = m.nverts();
+    m.points.create_points(points.size());
+    for (int i=0; i<(int)points.size(); i++)
+        m.points[offset + i] = points[i];
+    m.conn->v2c.resize(m.nverts(), -1);
+
+    for (int f : killed){
+        m.conn->active[f] = false;
+        for (int i = 0; i < 4; i++){
+            int c = m.facet_corner(f, i);
+            int& first = m.conn->v2c[m.facets[c]];
+            if (first == c)
+                first = m.conn->c2c[c];
+            else {
+                int before = first;
+                while (m.conn->c2c[before] != c)
+                    before = m.conn->c2c[before];
+                m.conn->c2c[before] = m.conn->c2c[c];
+            }
+            m.conn->c2c[c] = -1;
+        }
+    }
+
+    for (int i = 0; i < (int)newQuads.size(); i += 4)
+        m.conn->create_facet({newQuads[i], newQuads[i+1], newQuads[i+2], newQuads[i+3]});
+}
+
+inline void compactedIds(Quads& m, std::vector<int>& facetIds, std::vector<int>& vertexIds, int& nbFacets, int& nbVertices){
+    // The ids the active facets, and the vertices they use, would have once m is compacted, -1 for the others
+    facetIds.assign(m.nfacets(), -1);
+    vertexIds.assign(m.nverts(), -1);
+    nbFacets = 0;
+    for (int f = 0; f < m.nfacets(); f++)
+        if (m.conn->active[f]){
+            facetIds[f] = nbFacets++;
+            for (int i = 0; i < 4; i++)
+                vertexIds[m.vert(f, i)] = 0;
+        }
+    nbVertices = 0;
+    for (int v = 0; v < m.nverts(); v++)
+        if (vertexIds[v] == 0)
+            vertexIds[v] = nbVertices++;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Animation log
+//
+// The mesh at the start of the main loop, then one frame per remesh with what replaceFacets was given: the killed facets, as the gaps between
+// their sorted ids, the new points, and the new quads. The counts and ids are written as variable length integers, 7 bits a byte, and the
+// coordinates as doubles in the byte order of the machine, so a frame takes a few hundred bytes where a whole mesh was written before.
+// The frames are encoded by the remeshing thread, and written by a background writer
+
+inline const char animationMagic[8] = {'B', 'U', 'N', 'I', 'N', 'A', 'N', '1'};
+
+inline void writeVarint(std::string& out, uint64_t value){
+    while (value >= 0x80){
+        out.push_back(char((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+inline bool readVarint(std::istream& in, uint64_t& value){
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7){
+        int byte = in.get();
+        if (byte == EOF)
+            return false;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+inline void writePoints(std::string& out, const std::vector<vec3>& points){
+    writeVarint(out, points.size());
+    out.append(reinterpret_cast<const char*>(points.data()), points.size()*sizeof(vec3));
+}
+
+// The counts are checked against the bytes left in the log before anything is allocated, so a corrupt count fails instead of asking for
+// more memory than there is
+
+inline bool readPoints(std::istream& in, std::vector<vec3>& points, uint64_t available){
+    uint64_t n;
+    if (!readVarint(in, n) || n > available / sizeof(vec3))
+        return false;
+    points.resize(n);
+    return (bool)in.read(reinterpret_cast<char*>(points.data()), n*sizeof(vec3));
+}
+
+inline void writeIds(std::string& out, const int* ids, int n){
+    writeVarint(out, n);
+    for (int i = 0; i < n; i++)
+        writeVarint(out, ids[i]);
+}
+
+inline bool readIds(std::istream& in, std::vector<int>& ids, uint64_t available){
+    // each id takes a byte at least
+    uint64_t n;
+    if (!readVarint(in, n) || n > available)
+        return false;
+    ids.resize(n);
+    for (int& id : ids){
+        uint64_t value;
+        if (!readVarint(in, value) || value > uint64_t(std::numeric_limits<int>::max()))
+            return false;
+        id = value;
+    }
+    return true;
+}
+
+struct AnimationLog {
+    std::shared_ptr<std::ofstream> out; // null if the log isn't open
+    int frames = 0;
+    std::vector<int> gaps;
+    BackgroundWriter writer{256};
+
+    bool open(const std::string& path, Quads& m){
+        out = std::make_shared<std::ofstream>(path, std::ios::binary);
+        if (!out->is_open()){
+            out = nullptr;
+            return false;
+        }
+
+        std::string header(animationMagic, sizeof(animationMagic));
+        std::vector<vec3> points(m.nverts());
+        for (int v = 0; v < m.nverts(); v++)
+            points[v] = m.points[v];
+        writePoints(header, points);
+        writeIds(header, m.facets.data(), m.facets.size());
+        push(std::move(header));
+        return true;
+    }
+
+    void remesh(const std::vector<bool>& toKill, const std::vector<vec3>& points, const std::vector<int>& newQuads){
+        gaps.clear();
+        int previous = 0;
+        for (int f = 0; f < (int)toKill.size(); f++)
+            if (toKill[f]){
+                gaps.push_back(f - previous);
+                previous = f;
+            }
+        std::string frame;
+        writeIds(frame, gaps.data(), gaps.size());
+        writePoints(frame, points);
+        writeIds(frame, newQuads.data(), newQuads.size());
+        push(std::move(frame));
+        frames++;
+    }
+
+    void push(std::string&& bytes){
+        writer.push([out = out, bytes = std::move(bytes)](){
+            if (!out->write(bytes.data(), bytes.size()))
+                throw std::runtime_error("can't write the animation");
+        });
+    }
+
+    bool close(){
+        // Waits for the frames to be written. False if one of them couldn't be
+        if (out == nullptr)
+            return true;
+        bool written = writer.flush();
+        out->close();
+        return written && !out->fail();
+    }
+};
+
+// The remeshes committed on this thread are logged there when it is set, which the main loop does for the animated runs
+inline thread_local AnimationLog* animationLog = nullptr;
+
+struct AnimationReader {
+    std::ifstream in;
+    uint64_t size = 0;  // of the log, in bytes
+    int frame = 0;      // frame of the mesh, 0 being the one at the start of the main loop
+    std::string error;  // why the log stopped before its end, empty if it didn't
+    std::vector<int> gaps;
+    std::vector<vec3> points;
+    std::vector<int> quads;
+    std::vector<bool> toKill;
+
+    uint64_t available(){
+        return size - uint64_t(in.tellg());
+    }
+
+    bool validQuads(int nverts){
+        return quads.size() % 4 == 0 && std::all_of(quads.begin(), quads.end(), [&](int v){ return v < nverts; });
+    }
+
+    bool open(const std::string& path, Quads& m){
+        // Reads the first frame in m, which must be empty
+        in.open(path, std::ios::binary | std::ios::ate);
+        if (!in.is_open())
+            return false;
+        size = in.tellg();
+        in.seekg(0);
+        char magic[sizeof(animationMagic)];
+        if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, animationMagic, sizeof(magic)) != 0)
+            return false;
+        if (!readPoints(in, points, available()) || !readIds(in, quads, available()) || !validQuads((int)points.size()))
+            return false;
+
+        m.points.create_points(points.size());
+        for (int v = 0; v < (int)points.size(); v++)
+            m.points[v] = points[v];
+        m.create_facets(quads.size()/4);
+        std::copy(quads.begin(), quads.end(), m.facets.begin());
+        frame = 0;
+        return true;
+    }
+
+    bool next(Quads& m){
+        // Applies the next frame to m. False at the end of the log, with the error set if it ends in the middle of a frame or the frame
+        // doesn't fit the mesh, m being left at the previous frame
+        if (in.peek() == EOF)
+            return false;
+        if (!readIds(in, gaps, available()) || !readPoints(in, points, available()) || !readIds(in, quads, available())){
+            error = "frame " + std::to_string(frame + 1) + " is truncated";
+            return false;
+        }
+
+        toKill.assign(m.nfacets(), false);
+        int64_t f = 0;
+        for (int gap : gaps){
+            f += gap;
+            if (f >= m.nfacets()){
+                error = "frame " + std::to_string(frame + 1) + " removes a facet that doesn't exist";
+                return false;
+            }
+            toKill[f] = true;
+        }
+        if (!validQuads(m.nverts() + (int)points.size())){
+            error = "frame " + std::to_string(frame + 1) + " has a quad with a vertex that doesn't exist";
+            return false;
+        }
+        replaceFacets(m, toKill, points, quads);
+        frame++;
+        return true;
+    }
+};
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ultimaille/all.h>
+#include "bunin.h"
+#include "profiling.h"
+#include "reader.h"
+#include "writer.h"
+
+using namespace UM;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Batch mode
+
+struct BatchResult {
+    std::string model;
+    std::string status = "not run";  // "ok", "stopped: " and the reason, or what went wrong
+    std::string writeError;          // set by the writer thread alone, and moved to the status once it is done
+    int defectsBefore = 0;
+    int defectsAfter = 0;
+    double seconds = 0;              // whole job, with the reading of the mesh but not its writing, done in the background
+
+    bool failed() const { return status != "ok" && status.rfind("stopped", 0) != 0; }
+};
+
+inline void runJobs(int nbJobs, int nbThreads, const std::function<void(int)>& job){
+    // Each worker thread takes the next job until there is none left, so long jobs don't hold the others back. The calling thread is one of them
+    std::atomic<int> next = 0;
+    auto worker = [&](){
+        for (int i = next++; i < nbJobs; i = next++)
+            job(i);
+    };
+
+    nbThreads = std::max(1, std::min(nbThreads, nbJobs));
+    std::vector<std::thread> workers;
+    for (int t = 1; t < nbThreads; t++)
+        workers.emplace_back(worker);
+    worker();
+    for (std::thread& thread : workers)
+        thread.join();
+}
+
+inline std::vector<std::string> batchModels(const std::string& input){
+    // The meshes of a directory, or the ones listed in a file, one path per line
+    std::vector<std::string> models;
+    if (std::filesystem::is_directory(input)){
+        for (auto& entry : std::filesystem::directory_iterator(input)){
+            std::string extension = entry.path().extension().string();
+            if (entry.is_regular_file() && (extension == ".mesh" || extension == ".obj" || extension == ".geogram" || extension == ".vtk"))
+                models.push_back(entry.path().string());
+        }
+        std::sort(models.begin(), models.end());
+        return models;
+    }
+
+    std::ifstream list(input);
+    std::string line;
+    while (std::getline(list, line)){
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (!line.empty() && line[0] != '#')
+            models.push_back(line);
+    }
+    return models;
+}
+
+inline void batchJob(BatchResult& result, const std::filesystem::path& outputDir, const std::string& cacheDir, const bunin::Options& options, BackgroundWriter& writer){
+    // The remeshed mesh is handed to the writer, which keeps it until it is written, so the worker can go on with the next one
+    auto start = std::chrono::steady_clock::now();
+    try {
+        // in cad mode, the hard edges come with the mesh, from the cache when there is one, see readInput
+        auto m = std::make_shared<Quads>();
+        auto inputHardEdges = options.cadMode ? std::make_unique<CornerFlags>(*m) : nullptr;
+        if (!readInput(*m, result.model, cacheDir, inputHardEdges.get()) || m->nfacets() == 0){
+            result.status = "can't read the mesh";
+            return;
+        }
+
+        FacetAttribute<int> fa(*m, 0);
+        CornerAttribute<int> hardEdges(*m, 0);
+        bunin::Options jobOptions = options;
+        if (inputHardEdges){
+            storeAttribute(*inputHardEdges, hardEdges);
+            inputHardEdges.reset();
+            jobOptions.cadMode = false;
+        }
+        bunin::Result run = bunin::remesh(*m, jobOptions, fa, hardEdges);
+        result.defectsBefore = run.defectsBefore;
+        result.defectsAfter = run.defectsAfter;
+        result.status = run.stopped.empty() ? "ok" : "stopped: " + run.stopped;
+
+        std::string file = (outputDir / std::filesystem::path(result.model).filename()).string();
+        writer.push([&result, m, fa, hardEdges, file](){
+            try {
+                write_by_extension(file, *m, {{}, {{"patch", fa.ptr}, }, {{"hardedges", hardEdges.ptr},}});
+            } catch (std::exception& e) {
+                result.writeError = std::string("error: ") + e.what();
+            }
+        });
+    } catch (std::exception& e) {
+        result.status = std::string("error: ") + e.what();
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline std::vector<BatchResult> runBatch(const std::vector<std::string>& models, const std::filesystem::path& outputDir, const std::string& cacheDir, bunin::Options options, int nbThreads){
+    // The meshes are run with a single OpenMP thread, the parallelism coming from the workers, and quietly, the progress being printed here
+    std::vector<BatchResult> results(models.size());
+    for (int i = 0; i < (int)models.size(); i++)
+        results[i].model = models[i];
+
+    options.threads = 1;
+    options.verbose = false;
+    options.animationPath.clear();
+
+    // a remeshed mesh waiting for the writer per worker at most, before they wait for it
+    BackgroundWriter writer(nbThreads);
+    int done = 0;
+    std::mutex printing;
+    runJobs(models.size(), nbThreads, [&](int i){
+        if (options.cancel != nullptr && *options.cancel){
+            results[i].status = "cancelled";
+            return;
+        }
+        batchJob(results[i], outputDir, cacheDir, options, writer);
+
+        std::lock_guard<std::mutex> lock(printing);
+        std::cout << "[" << ++done << "/" << models.size() << "] " << results[i].model << ": " << results[i].status << ", "
+                  << results[i].defectsBefore - results[i].defectsAfter << " out of " << results[i].defectsBefore << " defects corrected in "
+                  << std::fixed << std::setprecision(2) << results[i].seconds << "s" << std::defaultfloat << std::endl;
+    });
+    writer.flush();
+
+    // the worker printing the progress of a mesh may still have been reading its status, so the writer left its errors aside until now
+    for (BatchResult& result : results)
+        if (!result.writeError.empty()){
+            result.status = result.writeError;
+            std::cout << result.model << ": " << result.status << std::endl;
+        }
+
+    return results;
+}
+
+inline bool writeBatchResults(const std::string& path, const std::vector<BatchResult>& results, double seconds){
+    std::ofstream out(path);
+    if (!out.is_open())
+        return false;
+
+    int defectsBefore = 0;
+    int defectsAfter = 0;
+    int failures = 0;
+    for (const BatchResult& result : results){
+        defectsBefore += result.defectsBefore;
+        defectsAfter += result.defectsAfter;
+        failures += result.failed();
+    }
+
+    out << std::setprecision(9);
+    out << "{\n";
+    out << "  \"meshes\": " << results.size() << ",\n";
+    out << "  \"failures\": " << failures << ",\n";
+    out << "  \"defects\": {\"before\": " << defectsBefore << ", \"after\": " << defectsAfter << "},\n";
+    out << "  \"seconds\": " << seconds << ",\n";
+    out << "  \"results\": [";
+    bool first = true;
+    for (const BatchResult& result : results){
+        out << (first ? "\n" : ",\n");
+        out << "    {\"model\": \"" << Profiler::escape(result.model) << "\", \"status\": \"" << Profiler::escape(result.status) << "\", \"defects\": {\"before\": "
+            << result.defectsBefore << ", \"after\": " << result.defectsAfter << "}, \"seconds\": " << result.seconds << "}";
+        first = false;
+    }
+    out << "\n  ]\n";
+    out << "}\n";
+
+    return true;
+}
@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <ultimaille/all.h>
+#include "bunin.h"
+#include "mainLoop.h"
+#include "matrixEquations.h"
+#include "param_parser.h"
+
+using namespace UM;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Timing
+
+struct Benchmark {
+    std::string name;
+    std::string suite;
+    long ops = 1;                 // calls of the measured function in each sample
+    std::vector<double> samples;  // seconds per sample
+    int defectsBefore = -1;       // only for the end-to-end runs
+    int defectsAfter = -1;
+
+    Benchmark(const std::string& name, const std::string& suite) : name(name), suite(suite) {}
+
+    double min() const {
+        return *std::min_element(samples.begin(), samples.end());
+    }
+
+    double median() const {
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        int n = sorted.size();
+        return n % 2 ? sorted[n/2] : (sorted[n/2-1] + sorted[n/2]) / 2;
+    }
+
+    double mean() const {
+        double total = 0;
+        for (double s : samples)
+            total += s;
+        return total / samples.size();
+    }
+
+    double stddev() const {
+        double mu = mean();
+        double total = 0;
+        for (double s : samples)
+            total += (s-mu)*(s-mu);
+        return samples.size() > 1 ? std::sqrt(total / (samples.size()-1)) : 0;
+    }
+};
+
+inline double seconds(std::function<void()> f){
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline Benchmark micro(const std::string& name, int repeat, int warmup, std::function<void()> f){
+    // The number of calls per sample is doubled until a sample lasts at least 10ms, so short functions are not lost in the resolution of the clock
+    Benchmark bench(name, "micro");
+    while (seconds([&](){ for (long i = 0; i < bench.ops; i++) f(); }) < .01)
+        bench.ops *= 2;
+
+    for (int i = 0; i < warmup; i++)
+        for (long j = 0; j < bench.ops; j++)
+            f();
+    for (int i = 0; i < repeat; i++)
+        bench.samples.push_back(seconds([&](){ for (long j = 0; j < bench.ops; j++) f(); }) / bench.ops);
+    return bench;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Benchmarks
+
+inline void microBenchmarks(const std::string& model, int repeat, int warmup, const std::string& filter, std::vector<Benchmark>& results){
+    Quads m;
+    read_by_extension(model, m);
+    if (m.nfacets() == 0){
+        std::cerr << "Error: can't read quads from " << model << std::endl;
+        return;
+    }
+    m.connect();
+    CornerFlags ca(m);
+    FacetStates fa(m);
+    Triangles mTri = quand2tri(m);
+    BVH bvh(mTri);
+
+    auto run = [&](const std::string& name, std::function<void()> f){
+        if (name.find(filter) == std::string::npos)
+            return;
+        results.push_back(micro("micro/" + name, repeat, warmup, f));
+        std::cerr << "." << std::flush;
+    };
+
+    volatile long sink = 0; // keeps the results of the benchmarked functions alive
+
+    // the functions working on the whole mesh are timed for a call each, not per vertex or facet
+    run("getValence", [&](){
+        long total = 0;
+        for (Vertex v : m.iter_vertices())
+            total += getValence(v);
+        sink = sink + total;
+    });
+
+    run("DefectField", [&](){
+        DefectField field(m, ca);
+        sink = sink + field.nbLabels;
+    });
+
+    // the patches around all the defects, as built at the first iteration of the main loop, with each seeding
+    std::vector<int> defects;
+    for (Vertex v : m.iter_vertices())
+        if (getValence(v) != 4)
+            defects.push_back(v);
+    for (PatchSeeding seeding : {PatchSeeding::bfs, PatchSeeding::field}){
+        DefectField field(m, ca, seeding);
+        run(std::string("initialPatchConstruction ") + (seeding == PatchSeeding::bfs ? "bfs" : "field"), [&](){
+            for (int v : defects){
+                fa.fill(0);
+                std::list<int> patch;
+                std::list<int> patchConvexity;
+                std::vector<int> segments;
+                sink = sink + initialPatchConstruction(Vertex(m, v), field, fa, patch, patchConvexity, segments, m, ca);
+            }
+        });
+    }
+
+    // every side length up to 12
+    run("solve3equations", [&](){
+        int segments[3];
+        int partSegments[6];
+        for (segments[0] = 1; segments[0] <= 12; segments[0]++)
+            for (segments[1] = 1; segments[1] <= 12; segments[1]++)
+                for (segments[2] = 1; segments[2] <= 12; segments[2]++)
+                    sink = sink + solve3equations(segments, partSegments);
+    });
+
+    run("solve5equations", [&](){
+        int segments[5];
+        int partSegments[10];
+        for (int s = 0; s < 12*12*12*12*12; s++){
+            for (int i = 0, rest = s; i < 5; i++, rest /= 12)
+                segments[i] = rest % 12 + 1;
+            sink = sink + solve5equations(segments, partSegments);
+        }
+    });
+
+    // a 16x16 rectangle spanning the first facet, its boundary being created in the buffer
+    run("meshingRectangle", [&](){
+        const int n = 16;
+        RemeshBuffer buffer(m);
+        vec3 corners[4];
+        for (int i = 0; i < 4; i++)
+            corners[i] = m.points[m.vert(0, i)];
+        auto boundaryPoint = [&](double u, double v){
+            int p = buffer.createPoints(1);
+            buffer.pos(p) = (1-u)*(1-v)*corners[0] + u*(1-v)*corners[1] + u*v*corners[2] + (1-u)*v*corners[3];
+            return p;
+        };
+        std::vector<int> anodes(n), bnodes(n), cnodes(n), dnodes(n);
+        for (int i = 0; i < n; i++)
+            dnodes[i] = boundaryPoint(double(i)/(n-1), 0);
+        anodes[0] = dnodes[0];
+        cnodes[0] = dnodes[n-1];
+        for (int i = 1; i < n; i++){
+            anodes[i] = boundaryPoint(0, double(i)/(n-1));
+            cnodes[i] = boundaryPoint(1, double(i)/(n-1));
+        }
+        bnodes[0] = anodes[n-1];
+        bnodes[n-1] = cnodes[n-1];
+        for (int i = 1; i < n-1; i++)
+            bnodes[i] = boundaryPoint(double(i)/(n-1), 1);
+        meshingRectangle(anodes, bnodes, cnodes, dnodes, buffer, bvh);
+        sink = sink + buffer.quads.size();
+    });
+
+    run("BVH build", [&](){
+        BVH tree(mTri);
+        sink = sink + 1;
+    });
+
+    // points off the surface, one per facet, so the projections are not all on a vertex
+    std::vector<vec3> queries;
+    for (Facet f : m.iter_facets())
+        queries.push_back(f.geom<Quad3>().bary_verts() + .1*f.geom<Quad3>().normal());
+    run("BVH::project", [&](){
+        for (vec3& q : queries)
+            sink = sink + (bvh.project(q).x > 0);
+    });
+}
+
+inline std::vector<std::filesystem::path> bundledMeshes(const std::filesystem::path& root){
+    std::vector<std::filesystem::path> meshes;
+    for (const char* dir : {"mambo/Basic", "mambo/Simple", "mambo/Medium", "instantMeshes"}){
+        if (!std::filesystem::is_directory(root / dir))
+            continue;
+        std::vector<std::filesystem::path> files;
+        for (auto& entry : std::filesystem::directory_iterator(root / dir))
+            if (entry.is_regular_file())
+                files.push_back(entry.path());
+        std::sort(files.begin(), files.end());
+        meshes.insert(meshes.end(), files.begin(), files.end());
+    }
+    for (auto& entry : std::filesystem::directory_iterator(root))
+        if (entry.is_regular_file() && entry.path().extension() == ".geogram")
+            meshes.push_back(entry.path());
+    return meshes;
+}
+
+inline void endToEndBenchmarks(const std::filesystem::path& root, int repeat, int warmup, const std::string& filter, bool EDGE_FLIP, std::vector<Benchmark>& results){
+    // The whole pipeline but the reading and writing of the files, as done by main: BVH construction and the main loop, through the library
+    for (auto& path : bundledMeshes(root)){
+        std::string name = std::filesystem::relative(path, root).generic_string();
+        if (name.find(filter) == std::string::npos)
+            continue;
+
+        Benchmark bench("e2e/" + name, "e2e");
+        for (int i = 0; i < warmup + repeat; i++){
+            Quads m;
+            read_by_extension(path.string(), m);
+            if (m.nfacets() == 0){
+                std::cerr << std::endl << "Skipping " << name << ", not a quad mesh" << std::endl;
+                break;
+            }
+            bunin::Options options;
+            options.edgeFlipping = EDGE_FLIP;
+            bunin::Result result = bunin::remesh(m, options);
+            if (i < warmup)
+                continue;
+            bench.samples.push_back(result.seconds);
+            bench.defectsBefore = result.defectsBefore;
+            bench.defectsAfter = result.defectsAfter;
+        }
+        if (!bench.samples.empty())
+            results.push_back(bench);
+        std::cerr << "." << std::flush;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Output
+
+inline void writeJson(std::ostream& out, const std::vector<Benchmark>& results, int repeat, int warmup){
+    out << std::setprecision(9);
+    out << "{\n";
+    out << "  \"repeat\": " << repeat << ",\n";
+    out << "  \"warmup\": " << warmup << ",\n";
+    out << "  \"benchmarks\": [";
+    bool first = true;
+    for (const Benchmark& bench : results){
+        out << (first ? "\n" : ",\n");
+        out << "    {\"name\": \"" << Profiler::escape(bench.name) << "\", \"suite\": \"" << bench.suite << "\", \"ops\": " << bench.ops
+            << ", \"min\": " << bench.min() << ", \"median\": " << bench.median() << ", \"mean\": " << bench.mean() << ", \"stddev\": " << bench.stddev();
+        if (bench.defectsBefore >= 0)
+            out << ", \"defects\": {\"before\": " << bench.defectsBefore << ", \"after\": " << bench.defectsAfter << "}";
+        out << ", \"samples\": [";
+        for (int i = 0; i < (int)bench.samples.size(); i++)
+            out << (i ? ", " : "") << bench.samples[i];
+        out << "]}";
+        first = false;
+    }
+    out << "\n  ]\n";
+    out << "}\n";
+}
+
+inline void printTable(const std::vector<Benchmark>& results){
+    std::cout << std::left << std::setw(48) << "benchmark" << std::right << std::setw(14) << "min (ms)" << std::setw(14) << "median (ms)"
+              << std::setw(14) << "stddev (ms)" << std::setw(10) << "defects" << std::endl;
+    for (const Benchmark& bench : results){
+        std::cout << std::left << std::setw(48) << bench.name << std::right << std::fixed << std::setprecision(4)
+                  << std::setw(14) << 1e3*bench.min() << std::setw(14) << 1e3*bench.median() << std::setw(14) << 1e3*bench.stddev() << std::defaultfloat;
+        if (bench.defectsBefore >= 0)
+            std::cout << std::setw(10) << (std::to_string(bench.defectsAfter) + "/" + std::to_string(bench.defectsBefore));
+        std::cout << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Parameters params;
+    params.help = "Benchmarks of the quad remeshing, from its kernels to whole runs over the bundled meshes.";
+    params.add("enum", "suite", "all").possible_values("micro,e2e,all").description("Run the microbenchmarks, the end-to-end runs over the meshes, or both");
+    params.add("string", "model", "meshes/mambo/Simple/S1.mesh").description("Mesh the microbenchmarks are run on");
+    params.add("string", "meshes", "meshes").description("Directory of the bundled meshes, for the end-to-end runs");
+    params.add("string", "filter", "").description("Only run the benchmarks whose name contains this string");
+    params.add("int", "repeat", "5").description("Number of timed samples of each benchmark");
+    params.add("int", "warmup", "1").description("Number of untimed runs before the samples");
+    params.add("bool", "edge_flipping", "true").description("Enable edge flipping in the end-to-end runs");
+    params.add("string", "output", "").description("Write the results to this json file");
+    params.init_from_args(argc, argv);
+
+    std::string SUITE = params["suite"];
+    std::string MODEL = params["model"];
+    std::string MESHES = params["meshes"];
+    std::string FILTER = params["filter"];
+    int REPEAT = std::max(1, (int)params["repeat"]);
+    int WARMUP = std::max(0, (int)params["warmup"]);
+    bool EDGE_FLIP = params["edge_flipping"];
+    std::string OUTPUT = params["output"];
+
+    std::vector<Benchmark> results;
+    if (SUITE != "e2e")
+        microBenchmarks(MODEL, REPEAT, WARMUP, FILTER, results);
+    if (SUITE != "micro")
+        endToEndBenchmarks(MESHES, REPEAT, WARMUP, FILTER, EDGE_FLIP, results);
+    std::cerr << std::endl;
+
+    printTable(results);
+
+    if (!OUTPUT.empty()){
+        std::ofstream out(OUTPUT);
+        if (!out.is_open()){
+            std::cerr << "Error: can't write the results in " << OUTPUT << std::endl;
+            return EXIT_FAILURE;
+        }
+        writeJson(out, results, REPEAT, WARMUP);
+        std::cout << "Results exported in " << OUTPUT << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
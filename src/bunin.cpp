@@ -0,0 +1,316 @@
+#include "bunin.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include "incremental.h"
+#include "mainLoop.h"
+#include "region.h"
+#include "smoothing.h"
+#include "profiling.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace bunin {
+
+struct Projection::Data {
+    Triangles triangles;
+    BVH bvh;
+
+    Data(Triangles&& triangles) : triangles(std::move(triangles)), bvh(this->triangles) {}
+};
+
+Projection::Projection(UM::Quads& m){
+    // Constructing structure for projecting the new patches on the original mesh
+    ScopedTimer bvhTimer("quand2tri");
+    Triangles mTri = quand2tri(m);
+    bvhTimer.stop();
+    ScopedTimer constructionTimer("BVH");
+    data = std::make_unique<Data>(std::move(mTri));
+    constructionTimer.stop();
+    profiler.structure("quand2tri Triangles", meshBytes(data->triangles));
+    profiler.structure("BVH", data->bvh.bytes());
+}
+
+Projection::~Projection() = default;
+
+static Result run(UM::Quads& m, Projection& projection, const Options& options, UM::FacetAttribute<int>& patch, UM::CornerAttribute<int>& hardEdges, FacetFlags* frozen){
+    auto start = std::chrono::steady_clock::now();
+    bool wasVerbose = verbose;
+    verbose = options.verbose;
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+    if (options.threads > 0)
+        omp_set_num_threads(options.threads);
+#endif
+
+    if (!m.conn)
+        m.connect();
+
+    Result result;
+    result.defectsBefore = countDefect(m);
+    // the loop works on packed copies of the attributes, the int ones being only written back at the end
+    FacetStates fa(m);
+    CornerFlags ca(m);
+    FacetFlags remeshed(m, 1);
+    loadAttribute(ca, hardEdges);
+    profiler.structure("attributes", fa.bytes() + ca.bytes() + remeshed.bytes());
+
+    BVH& bvh = projection.data->bvh;
+
+    RunControl control;
+    control.start = start;
+    control.timeBudget = options.timeBudget;
+    control.iterationBudget = options.iterationBudget;
+    control.cancel = options.cancel;
+    if (options.progress)
+        control.progress = [&](int defects, int iterations, double seconds){ return options.progress({defects, iterations, seconds}); };
+
+    LoopSettings settings;
+    settings.animationPath = options.animationPath;
+    settings.maxPatchSize = options.maxPatchSize;
+    settings.cadMode = options.cadMode;
+    settings.edgeFlipping = options.edgeFlipping;
+    settings.rejectInverted = options.rejectInverted;
+    settings.rejectWorseValence = options.rejectWorseValence;
+    settings.order = options.order == Order::Hilbert ? CurveOrder::hilbert : options.order == Order::Morton ? CurveOrder::morton : CurveOrder::none;
+    settings.reorderEvery = options.reorderEvery;
+    settings.seeding = options.seeding == Seeding::BreadthFirst ? PatchSeeding::bfs : PatchSeeding::field;
+    settings.control = &control;
+    settings.frozen = frozen;
+    ScopedTimer loopTimer("mainLoop");
+    result.iterations = mainLoop(m, bvh, fa, remeshed, ca, settings);
+    loopTimer.stop();
+    if (control.stopped != nullptr)
+        result.stopped = control.stopped;
+
+    // the smoothing is short, and still worth doing on a run stopped by its budget, but not on a cancelled one
+    if (options.smoothIterations > 0 && !(options.cancel != nullptr && *options.cancel)){
+        ScopedTimer timer("smoothing");
+        if (options.smoothAll)
+            remeshed.fill(1);
+        smoothing(m, bvh, remeshed, ca, options.smoothIterations);
+    }
+    storeAttribute(fa, patch);
+    storeAttribute(ca, hardEdges);
+
+    result.defectsAfter = countDefect(m);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    verbose = wasVerbose;
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#endif
+    return result;
+}
+
+static Result runSelection(UM::Quads& m, Projection* projection, const Options& options, UM::FacetAttribute<int>& patch, UM::CornerAttribute<int>& hardEdges){
+    // The region is remeshed as a mesh of its own, on the projection of the whole mesh if there is one, or on a projection of the region
+    auto start = std::chrono::steady_clock::now();
+    if ((int)options.selection.size() != m.nfacets())
+        throw std::invalid_argument("the selection has " + std::to_string(options.selection.size()) + " values for " + std::to_string(m.nfacets()) + " facets");
+    if (!m.conn)
+        m.connect();
+
+    Result result;
+    result.defectsBefore = countDefect(m);
+    ScopedTimer extractionTimer("extractRegion");
+    Region region;
+    int nbSelected = extractRegion(m, options.selection, hardEdges, region);
+    extractionTimer.stop();
+    if (options.verbose)
+        std::cout << "Remeshing " << nbSelected << " selected facets out of " << m.nfacets() << std::endl;
+
+    if (nbSelected > 0){
+        Options regionOptions = options;
+        regionOptions.selection.clear();
+        regionOptions.order = Order::Input; // the region keeps the vertices it was copied from
+        std::unique_ptr<Projection> regionProjection;
+        if (projection == nullptr){
+            regionProjection = std::make_unique<Projection>(region.m);
+            projection = regionProjection.get();
+        }
+        Result regionResult = run(region.m, *projection, regionOptions, region.patch, region.hardEdges, &region.frozen);
+        result.iterations = regionResult.iterations;
+        result.stopped = regionResult.stopped;
+
+        ScopedTimer mergeTimer("mergeRegion");
+        mergeRegion(m, options.selection, region, patch, hardEdges);
+    }
+
+    result.defectsAfter = countDefect(m);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+Result remesh(UM::Quads& m, Projection& projection, const Options& options, UM::FacetAttribute<int>& patch, UM::CornerAttribute<int>& hardEdges){
+    if (!options.selection.empty())
+        return runSelection(m, &projection, options, patch, hardEdges);
+    return run(m, projection, options, patch, hardEdges, nullptr);
+}
+
+Result remesh(UM::Quads& m, const Options& options, UM::FacetAttribute<int>& patch, UM::CornerAttribute<int>& hardEdges){
+    if (!options.selection.empty())
+        return runSelection(m, nullptr, options, patch, hardEdges);
+    auto start = std::chrono::steady_clock::now();
+    Projection projection(m);
+    Result result = remesh(m, projection, options, patch, hardEdges);
+    // the projection structure is part of the run
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+Result remesh(UM::Quads& m, const Options& options){
+    FacetAttribute<int> patch(m, 0);
+    CornerAttribute<int> hardEdges(m, 0);
+    return remesh(m, options, patch, hardEdges);
+}
+
+static std::unique_ptr<Projection> projectNear(UM::Quads& m, std::vector<vec3>& points, std::vector<int>& facets){
+    // Moves the points to the closest point of m, and sets facets to the facets they are moved to, with the BVH of the facets around them.
+    // Its search radius is doubled until the closest facets found are closer than any other could be. Returns the projection on these facets
+    double span = longestSpan(m);
+    double radius = 2*span;
+    std::vector<vec3> closest(points.size());
+    std::vector<int> triangles(points.size());
+    while (true){
+        UM::Quads part;
+        std::vector<int> partFacets;
+        extractNear(m, points, radius, part, partFacets);
+        auto projection = std::make_unique<Projection>(part);
+        double distance = 0;
+        for (int i = 0; i < (int)points.size(); i++){
+            closest[i] = projection->data->bvh.project(points[i], triangles[i]);
+            distance = std::max(distance, triangles[i] >= 0 ? (closest[i] - points[i]).norm() : radius);
+        }
+        if (distance + span <= radius || part.nfacets() == m.nfacets()){
+            points.swap(closest);
+            facets.resize(points.size());
+            for (int i = 0; i < (int)points.size(); i++)
+                facets[i] = triangles[i] >= 0 ? partFacets[triangles[i] / 2] : -1;
+            return projection;
+        }
+        radius *= 2;
+    }
+}
+
+Result update(UM::Quads& previousInput, UM::Quads& previousOutput, UM::Quads& m, const Options& options, UM::FacetAttribute<int>& patch, UM::CornerAttribute<int>& hardEdges){
+    auto start = std::chrono::steady_clock::now();
+    std::vector<vec3> points;
+    std::vector<bool> removed;
+    ScopedTimer bandTimer("selectBand");
+    int nbChanged = changedFacets(previousInput, m, points, removed);
+    int nbRemoved = std::count(removed.begin(), removed.end(), true);
+    if (nbRemoved == previousInput.nfacets() && m.nfacets() > 0){
+        bandTimer.stop();
+        if (options.verbose)
+            std::cout << "No facet of the previous input is left in the input, it is remeshed as a whole" << std::endl;
+        Options wholeOptions = options;
+        wholeOptions.selection.clear();
+        return remesh(m, wholeOptions, patch, hardEdges);
+    }
+
+    Options bandOptions = options;
+    std::vector<bool>& band = bandOptions.selection;
+    band.assign(previousOutput.nfacets(), false);
+    std::vector<int> facets;
+    if (nbChanged > 0 && previousOutput.nfacets() > 0){
+        projectNear(previousOutput, points, facets);
+        for (int f : facets)
+            if (f >= 0)
+                band[f] = true;
+        growBand(previousOutput, band, options.band);
+    }
+
+    // the facets of the band lying on a facet taken out of the input, with their centroid farther from the new input than from the previous
+    // one by more than a quarter of their size, are over a hole of it. A facet replaced by others is still covered by them, and a hole
+    // smaller than the facets of the band is covered by its facets projected around it, so these stay
+    std::vector<bool> dropped(previousOutput.nfacets(), false);
+    if (nbRemoved > 0){
+        std::vector<int> bandFacets;
+        std::vector<vec3> centroids;
+        for (int f = 0; f < previousOutput.nfacets(); f++)
+            if (band[f]){
+                bandFacets.push_back(f);
+                centroids.push_back(facetCentroid(previousOutput, f));
+            }
+        std::vector<vec3> onPrevious = centroids;
+        std::vector<vec3> onInput = centroids;
+        std::vector<int> previousFacets;
+        if (!centroids.empty()){
+            projectNear(previousInput, onPrevious, previousFacets);
+            projectNear(m, onInput, facets);
+        }
+        for (int i = 0; i < (int)bandFacets.size(); i++)
+            dropped[bandFacets[i]] = previousFacets[i] >= 0 && removed[previousFacets[i]] && (onInput[i] - centroids[i]).norm() - (onPrevious[i] - centroids[i]).norm() > facetSpan(previousOutput, bandFacets[i]) / 4;
+    }
+    bandTimer.stop();
+    if (options.verbose)
+        std::cout << nbChanged << " facets of the inputs changed, " << std::count(band.begin(), band.end(), true) << " facets of the previous result in the band" << std::endl;
+
+    // the vertices inside of the band move to the new input, and the band is remeshed on its facets around them
+    std::vector<bool> fixed(previousOutput.nverts(), false);
+    for (int f = 0; f < previousOutput.nfacets(); f++)
+        if (!band[f])
+            for (int i = 0; i < 4; i++)
+                fixed[previousOutput.vert(f, i)] = true;
+    std::vector<int> vertices;
+    points.clear();
+    for (int f = 0; f < previousOutput.nfacets(); f++)
+        if (band[f])
+            for (int i = 0; i < 4; i++){
+                int v = previousOutput.vert(f, i);
+                if (!fixed[v]){
+                    fixed[v] = true;
+                    vertices.push_back(v);
+                    points.push_back(previousOutput.points[v]);
+                }
+            }
+    std::unique_ptr<Projection> projection;
+    if (!points.empty()){
+        ScopedTimer projectionTimer("projectBand");
+        projection = projectNear(m, points, facets);
+    }
+
+    // m takes the previous output
+    if (m.conn)
+        m.disconnect();
+    m.delete_facets(std::vector<bool>(m.nfacets(), true));
+    m.delete_isolated_vertices();
+    copy(previousOutput, m);
+    for (int i = 0; i < (int)vertices.size(); i++)
+        m.points[vertices[i]] = points[i];
+    int nbDropped = std::count(dropped.begin(), dropped.end(), true);
+    if (nbDropped > 0){
+        m.delete_facets(dropped);
+        m.delete_isolated_vertices();
+        int kept = 0;
+        for (int f = 0; f < (int)band.size(); f++)
+            if (!dropped[f])
+                band[kept++] = band[f];
+        band.resize(kept);
+        if (options.verbose)
+            std::cout << nbDropped << " facets of the previous result over the facets taken out of the input are taken out" << std::endl;
+    }
+
+    Result result = runSelection(m, projection.get(), bandOptions, patch, hardEdges);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+Result update(UM::Quads& previousInput, UM::Quads& previousOutput, UM::Quads& m, const Options& options){
+    FacetAttribute<int> patch(m, 0);
+    CornerAttribute<int> hardEdges(m, 0);
+    return update(previousInput, previousOutput, m, options, patch, hardEdges);
+}
+
+void copy(UM::Quads& from, UM::Quads& to){
+    to.points.create_points(from.nverts());
+    for (int v = 0; v < from.nverts(); v++)
+        to.points[v] = from.points[v];
+    to.create_facets(from.nfacets());
+    std::copy(from.facets.begin(), from.facets.end(), to.facets.begin());
+}
+
+}
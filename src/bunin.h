@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ultimaille/all.h>
+
+// Library interface of the remeshing, for the programs working on meshes in memory
+
+namespace bunin {
+
+struct Progress {
+    int defects = 0;              // defects left in the mesh
+    int iterations = 0;
+    double seconds = 0;
+};
+
+enum class Order {
+    Input,                        // as in the input
+    Morton,                       // facets along a Morton curve, vertices in the order the facets use them
+    Hilbert                       // same along a Hilbert curve, which keeps closer facets together
+};
+
+enum class Seeding {
+    NearestDefects,               // the smallest ball reaching the 2 defects closest to it, in a distance field kept up to date between the remeshes
+    BreadthFirst                  // the facets met by a breadth-first search from the defect until it has seen 3 defects, as in the first versions
+};
+
+struct Options {
+    int maxPatchSize = 500;       // maximum number of facets in a patch to remesh
+    bool cadMode = false;         // respect the sharp angles of the mesh
+    bool edgeFlipping = true;     // flip edges before the remeshing
+    bool rejectInverted = false;  // reject the remeshes with quads facing the wrong side of the surface
+    bool rejectWorseValence = false; // reject the remeshes raising the summed distance to valence 4 of the vertices of the patch
+    int smoothIterations = 0;     // tangential smoothing iterations after the remeshing
+    bool smoothAll = false;       // smooth the whole mesh, rather than only the remeshed patches
+    Seeding seeding = Seeding::NearestDefects; // how the first patch around a defect is found
+    Order order = Order::Input;   // order of the vertices and facets during the remeshing, which is also the order the defects are tried in.
+                                  // The attributes bound to m follow it if they hold int, double, bool or vec3 values, or else m keeps its
+                                  // order. Not applied to a selection
+    int reorderEvery = 0;         // remeshes after which m is reordered again, as the remeshed patches are appended at its end, never if 0.
+                                  // Not done while an animation is logged
+    std::vector<bool> selection;  // facets that may be remeshed, one per facet of the mesh, all of them if empty. See region.h
+    int band = 2;                 // rings of facets around the changes remeshed again by update
+    int threads = 0;              // OpenMP threads of the smoothing, 0 keeps the default
+    bool verbose = false;         // print the progress on std::cout
+    std::string animationPath;    // file where to log the remeshes, see animation.h, none if empty
+
+    // The run can be stopped before its end, leaving the mesh as remeshed so far
+    double timeBudget = 0;                          // seconds, none if 0
+    int iterationBudget = 0;                        // none if 0
+    const std::atomic<bool>* cancel = nullptr;      // set from another thread to stop the run
+    std::function<bool(const Progress&)> progress;  // called after each remesh, the run stops if it returns false
+};
+
+struct Result {
+    int defectsBefore = 0;
+    int defectsAfter = 0;
+    int iterations = 0;           // iterations of the main loop, each one but the last ending with a remesh
+    double seconds = 0;
+    std::string stopped;          // why the run stopped before its end, empty if it didn't
+};
+
+// Structure projecting the new points on the input surface: a triangulation of the mesh and its BVH. It only depends on the input, so it can be
+// built once and shared by runs with different options on copies of the mesh, in parallel too since they only query it
+struct Projection {
+    explicit Projection(UM::Quads& m);
+    ~Projection();
+
+    struct Data;
+    std::unique_ptr<Data> data;
+};
+
+// Remeshes m in place. The mesh doesn't need to be connected.
+// patch is set to the state of the last patch tried, and hardEdges to the hard edges found in CAD mode, with the ones it held already.
+// They are copied in and out of the compact attributes the remeshing works on, so hardEdges must only hold 0 and 1.
+// With a selection, only its facets are replaced, the remeshed ones being moved at the end of m, and the hard edges are only looked for
+// inside of it. The animation then shows the selection and the ring of facets around it. Throws std::invalid_argument if the size of
+// the selection isn't the number of facets
+Result remesh(UM::Quads& m, const Options& options, UM::FacetAttribute<int>& patch, UM::CornerAttribute<int>& hardEdges);
+Result remesh(UM::Quads& m, const Options& options);
+// Same, m being a copy of the mesh projection was built from
+Result remesh(UM::Quads& m, Projection& projection, const Options& options, UM::FacetAttribute<int>& patch, UM::CornerAttribute<int>& hardEdges);
+
+// Remeshes m, an edit of previousInput moving some of its vertices or taking out or adding facets, reusing previousOutput, the result of the
+// remeshing of previousInput: m is replaced by previousOutput, and only a band of options.band rings of facets around the facets changed is
+// projected on m and remeshed, as a selection, see incremental.h. If no facet of previousInput is left in m, m is remeshed as a whole. The
+// selection of options is replaced by the band
+Result update(UM::Quads& previousInput, UM::Quads& previousOutput, UM::Quads& m, const Options& options, UM::FacetAttribute<int>& patch, UM::CornerAttribute<int>& hardEdges);
+Result update(UM::Quads& previousInput, UM::Quads& previousOutput, UM::Quads& m, const Options& options);
+
+// Copies the points and the facets of from into the empty mesh to
+void copy(UM::Quads& from, UM::Quads& to);
+
+}
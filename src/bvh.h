@@ -3,6 +3,7 @@
 #include <ultimaille/all.h>
 #include <numeric>
 #include <algorithm>
+#include "profiling.h"
 
 
 // From Yoann Coudert-Osmont
@@ -118,8 +119,21 @@ public:
         init(tri_inds.begin(), m.nfacets());
     }
 
+    vec3 facet_normal(int f) { return UM::cross(geom(3*f+0), geom(3*f+1)).normalized(); }
+
+    // memory taken by the nodes, the triangles belonging to the mesh
+    long bytes() const { return nodes.capacity() * sizeof(nodes[0]); }
+
     vec3 project(const vec3 &p) {
-        if(m.nfacets() == 0) return p;
+        int f;
+        return project(p, f);
+    }
+
+    // also gives the triangle p has been projected on
+    vec3 project(const vec3 &p, int &facet) {
+        HotTimer timer("bvh.project");
+        facet = 0;
+        if(m.nfacets() == 0) { facet = -1; return p; }
         else if(m.nfacets() == 1) return proj_facet(p, 0);
         using QEl = std::pair<double, int>;
         std::priority_queue<QEl, std::vector<QEl>, std::greater<QEl>> Q;
@@ -136,6 +150,7 @@ public:
                     if(d2 < best_dist2) {
                         best_dist2 = d2;
                         q = q2;
+                        facet = std::get<0>(nodes[j]);
                     }
                 } else Q.emplace(dist2_box(std::get<2>(nodes[j]), p), j); 
             }
@@ -0,0 +1,69 @@
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <ultimaille/all.h>
+#include "animation.h"
+#include "param_parser.h"
+
+using namespace UM;
+
+inline std::string frameFile(const std::filesystem::path& directory, int frame, const std::string& format){
+    // numbered on 4 digits at least, so the files are in order
+    std::string number = std::to_string(frame);
+    if (number.size() < 4)
+        number = std::string(4 - number.size(), '0') + number;
+    return (directory / (number + "." + format)).string();
+}
+
+int main(int argc, char* argv[]) {
+    Parameters params;
+    params.help = "Expands the frames of an animation log, written by main with animate=true, into meshes.";
+    params.add("string", "animation", "").description("Animation log");
+    params.add("int", "frame", "-1").description("Frame to expand, 0 being the mesh before the first remesh, -1 for the last one");
+    params.add("bool", "all", "false").description("Expand all the frames");
+    params.add("enum", "format", "geogram").possible_values("geogram,mesh,obj").description("Format of the frames");
+    params.add("string", "output", "output/animation").description("Directory where to write the frames");
+    params.init_from_args(argc, argv);
+
+    std::string ANIMATION = params["animation"];
+    int FRAME = params["frame"];
+    bool ALL = params["all"];
+    std::string FORMAT = params["format"];
+    std::filesystem::path OUTPUT((std::string)params["output"]);
+
+    Quads m;
+    AnimationReader reader;
+    if (!reader.open(ANIMATION, m)){
+        std::cerr << "Error: " << ANIMATION << " is not an animation log" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::filesystem::create_directories(OUTPUT);
+
+    // the frames are rebuilt one after the other from the first one, only the wanted ones being written
+    int written = 0;
+    do {
+        if (ALL || reader.frame == FRAME){
+            write_by_extension(frameFile(OUTPUT, reader.frame, FORMAT), m);
+            written++;
+            if (!ALL)
+                break;
+        }
+    } while (reader.next(m));
+    if (!reader.error.empty()){
+        std::cerr << "Error: " << ANIMATION << " is corrupt, " << reader.error << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (!ALL && FRAME == -1){
+        write_by_extension(frameFile(OUTPUT, reader.frame, FORMAT), m);
+        written++;
+    }
+    if (written == 0){
+        std::cerr << "Error: the animation has " << reader.frame + 1 << " frames, there is no frame " << FRAME << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << written << " frames exported in " << OUTPUT.string() << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <numbers>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <ultimaille/all.h>
+#include "mainLoop.h"
+#include "param_parser.h"
+
+using namespace UM;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Shapes
+
+inline void grid(Quads& m, int resolution, bool hardEdges){
+    // The faces of a cube, each one a grid of resolution x resolution quads, so the mesh is closed. Its 8 corners have a valence of 3 and its
+    // edges are hard edges. Without hard edges, the cube is rounded into a sphere
+    int n = resolution;
+    std::vector<vec3> positions;
+    std::unordered_map<long long, int> lattice; // points shared by two faces are only created once
+    auto point = [&](int x, int y, int z){
+        auto [it, inserted] = lattice.try_emplace(((long long)x*(n+1) + y)*(n+1) + z, (int)positions.size());
+        if (inserted){
+            vec3 p = vec3(x, y, z)*(2./n) - vec3(1, 1, 1);
+            if (!hardEdges)
+                p.normalize();
+            positions.push_back(p);
+        }
+        return it->second;
+    };
+
+    std::vector<int> quads;
+    for (int axis = 0; axis < 3; axis++)
+        for (int side = 0; side < 2; side++){
+            // u x v goes out of the cube
+            int u = (axis + (side ? 1 : 2)) % 3;
+            int v = (axis + (side ? 2 : 1)) % 3;
+            for (int i = 0; i < n; i++)
+                for (int j = 0; j < n; j++)
+                    for (auto [di, dj] : {std::pair{0, 0}, {1, 0}, {1, 1}, {0, 1}}){
+                        int xyz[3];
+                        xyz[axis] = side*n;
+                        xyz[u] = i + di;
+                        xyz[v] = j + dj;
+                        quads.push_back(point(xyz[0], xyz[1], xyz[2]));
+                    }
+        }
+
+    m.points.create_points(positions.size());
+    for (int i = 0; i < (int)positions.size(); i++)
+        m.points[i] = positions[i];
+    m.create_facets(quads.size()/4);
+    std::copy(quads.begin(), quads.end(), m.facets.begin());
+}
+
+inline vec3 torusSection(double t, bool square){
+    // Point of the cross-section of the tube at t in [0, 1), in the plane of the radius and the axis. The square one has 4 hard edges
+    if (!square)
+        return {std::cos(2*std::numbers::pi*t), 0, std::sin(2*std::numbers::pi*t)};
+
+    double s = 4*t;
+    int side = std::min(3, (int)s);
+    double u = 2*(s - side) - 1;
+    switch (side){
+        case 0: return {1, 0, u};
+        case 1: return {-u, 0, 1};
+        case 2: return {-1, 0, -u};
+        default: return {u, 0, -1};
+    }
+}
+
+inline void torus(Quads& m, int resolution, bool hardEdges){
+    // The tube is a quarter of the radius of the torus, so its quads are close to squares with a quarter of the resolution around it
+    double R = 1;
+    double r = .25;
+    int nu = resolution;
+    int nv = std::max(4, (resolution/4 + 3) / 4 * 4);
+
+    m.points.create_points(nu*nv);
+    for (int i = 0; i < nu; i++){
+        double angle = 2*std::numbers::pi*i / nu;
+        for (int j = 0; j < nv; j++){
+            vec3 p = torusSection(double(j) / nv, hardEdges);
+            double radius = R + r*p.x;
+            m.points[i*nv + j] = {radius*std::cos(angle), radius*std::sin(angle), r*p.z};
+        }
+    }
+
+    m.create_facets(nu*nv);
+    for (int i = 0; i < nu; i++)
+        for (int j = 0; j < nv; j++){
+            int f = i*nv + j;
+            m.vert(f, 0) = i*nv + j;
+            m.vert(f, 1) = ((i+1) % nu)*nv + j;
+            m.vert(f, 2) = ((i+1) % nu)*nv + (j+1) % nv;
+            m.vert(f, 3) = i*nv + (j+1) % nv;
+        }
+}
+
+inline void subdivide(Quads& m){
+    // Splits each quad in 4, around a new point at its centre and new points in the middle of its edges. The points don't move, so the surface stays the same
+    m.connect();
+    int nverts = m.nverts();
+    int nfacets = m.nfacets();
+
+    std::vector<int> middle(4*nfacets, -1);
+    int next = nverts;
+    for (int f = 0; f < nfacets; f++)
+        for (int i = 0; i < 4; i++){
+            int c = m.facet_corner(f, i);
+            if (middle[c] != -1)
+                continue;
+            middle[c] = next;
+            int opposite = Halfedge(m, c).opposite();
+            if (opposite != -1)
+                middle[opposite] = next;
+            next++;
+        }
+
+    std::vector<vec3> positions(next + nfacets);
+    for (int f = 0; f < nfacets; f++){
+        vec3 centre = {0, 0, 0};
+        for (int i = 0; i < 4; i++){
+            vec3 a = m.points[m.vert(f, i)];
+            vec3 b = m.points[m.vert(f, (i+1) % 4)];
+            positions[middle[m.facet_corner(f, i)]] = (a + b) / 2;
+            centre += a / 4;
+        }
+        positions[next + f] = centre;
+    }
+
+    std::vector<int> quads(16*nfacets);
+    for (int f = 0; f < nfacets; f++)
+        for (int i = 0; i < 4; i++){
+            int* quad = quads.data() + 16*f + 4*i;
+            quad[0] = m.vert(f, i);
+            quad[1] = middle[m.facet_corner(f, i)];
+            quad[2] = next + f;
+            quad[3] = middle[m.facet_corner(f, (i+3) % 4)];
+        }
+
+    m.disconnect();
+    m.points.create_points(positions.size() - nverts);
+    for (int v = nverts; v < (int)positions.size(); v++)
+        m.points[v] = positions[v];
+    m.create_facets(3*nfacets);
+    std::copy(quads.begin(), quads.end(), m.facets.begin());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Defects
+
+inline int injectDefects(Quads& m, double density, int seed){
+    // Rotates an edge between two quads of a regular region, as edgeFlipping does the other way round: its two ends get a valence of 3 and the two
+    // vertices it now joins a valence of 5, so each rotation makes two pairs of valence 3/5 defects. density is the number of pairs per 1000 quads.
+    // The rotated edges are kept apart from each other, from the borders and from the hard edges
+    m.connect();
+    CornerFlags hardEdges(m);
+    markHardEdges(m, hardEdges);
+
+    int wanted = std::round(density * m.nfacets() / 1000 / 2);
+    std::vector<bool> blocked(m.nfacets(), false);
+    std::vector<int> candidates(m.nfacets());
+    for (int f = 0; f < m.nfacets(); f++)
+        candidates[f] = f;
+    std::mt19937 random(seed);
+    std::shuffle(candidates.begin(), candidates.end(), random);
+
+    std::vector<std::array<int, 2>> rotations; // the two quads of each rotated edge, replaced by two of newQuads
+    std::vector<std::array<int, 4>> newQuads;
+    for (int f : candidates){
+        if ((int)rotations.size() >= wanted)
+            break;
+
+        Halfedge he(m, m.facet_corner(f, random() % 4));
+        if (he.opposite() == -1 || blocked[he.facet()] || blocked[he.opposite().facet()])
+            continue;
+
+        Vertex a = he.from();
+        Vertex b = he.to();
+        Vertex d = he.next().to();
+        Vertex f1 = he.next().next().to();
+        Vertex c = he.opposite().next().to();
+        Vertex e = he.opposite().next().next().to();
+
+        // the walk around a vertex stops at the border, where getValence can't be used
+        bool regular = true;
+        std::vector<int> around;
+        for (Vertex v : {a, b, c, d, e, f1}){
+            Halfedge h = v.halfedge();
+            int valence = 0;
+            do {
+                if (h.opposite() == -1 || hardEdges[h] == 1 || blocked[h.facet()] || ++valence > 4){
+                    regular = false;
+                    break;
+                }
+                around.push_back(h.facet());
+                h = h.opposite().next();
+            } while (h != v.halfedge());
+            regular = regular && valence == 4;
+            if (!regular)
+                break;
+        }
+        if (!regular)
+            continue;
+
+        for (int facet : around)
+            blocked[facet] = true;
+        rotations.push_back({he.facet(), he.opposite().facet()});
+        newQuads.push_back({c, e, b, d});
+        newQuads.push_back({c, d, f1, a});
+    }
+
+    m.disconnect();
+    for (int i = 0; i < (int)rotations.size(); i++)
+        for (int j = 0; j < 2; j++)
+            for (int k = 0; k < 4; k++)
+                m.vert(rotations[i][j], k) = newQuads[2*i + j][k];
+    return rotations.size();
+}
+
+int main(int argc, char* argv[]) {
+    Parameters params;
+    params.help = "Generates large quad meshes with defects, to measure how the remeshing scales.";
+    params.add("enum", "shape", "grid").possible_values("grid,torus,copy").description("Grids on the faces of a cube, a torus, or a copy of an existing mesh");
+    params.add("string", "model", "").description("Mesh to copy, for the copy shape");
+    params.add("int", "resolution", "400").description("Number of quads along an edge of the cube, or around the torus");
+    params.add("int", "subdivisions", "0").description("Number of times each quad is split in 4");
+    params.add("double", "defect_density", "1").description("Number of injected valence 3/5 defect pairs per 1000 quads");
+    params.add("bool", "hard_edges", "false").description("Keep the edges of the cube rather than rounding it into a sphere, or give the torus a square section");
+    params.add("int", "seed", "0").description("Seed of the placement of the defects");
+    params.add("string", "output", "output/generated.mesh").description("Generated mesh");
+    params.init_from_args(argc, argv);
+
+    std::string SHAPE = params["shape"];
+    std::string MODEL = params["model"];
+    int RESOLUTION = std::max(2, (int)params["resolution"]);
+    int SUBDIVISIONS = params["subdivisions"];
+    double DEFECT_DENSITY = params["defect_density"];
+    bool HARD_EDGES = params["hard_edges"];
+    int SEED = params["seed"];
+    std::string OUTPUT = params["output"];
+
+    Quads m;
+    if (SHAPE == "grid")
+        grid(m, RESOLUTION, HARD_EDGES);
+    else if (SHAPE == "torus")
+        torus(m, RESOLUTION, HARD_EDGES);
+    else if (!loadingInput(m, MODEL))
+        return EXIT_FAILURE;
+
+    for (int i = 0; i < SUBDIVISIONS; i++)
+        subdivide(m);
+
+    int rotations = injectDefects(m, DEFECT_DENSITY, SEED);
+
+    m.connect();
+    std::cout << "Generated " << m.nverts() << " vertices, " << m.nfacets() << " quads, " << countDefect(m) << " defects, "
+              << 4*rotations << " of them injected" << std::endl;
+
+    std::filesystem::path parent = std::filesystem::path(OUTPUT).parent_path();
+    if (!parent.empty())
+        std::filesystem::create_directories(parent);
+    write_by_extension(OUTPUT, m);
+    std::cout << "Mesh exported in " << OUTPUT << std::endl;
+
+    return EXIT_SUCCESS;
+}
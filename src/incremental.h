@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <ultimaille/all.h>
+
+using namespace UM;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Incremental re-run
+//
+// An edit of the input only needs the previous result to be remeshed around it. The facets of the two inputs are matched by the positions
+// of their vertices, and the ones left unmatched, a vertex of which moved or which were taken out or added, are the changes. The facets of
+// the previous result their vertices and centroids are the closest to, before and after the edit, are grown by a few rings into the band.
+// The previous result is kept as it is outside of the band, its vertices inside of it are projected on the new input, the facets of the
+// band left over a hole of the new input are taken out, and the band is remeshed as a selection. The closest points are found with the
+// BVH of the facets around the points only, its construction costing much more than the remeshing of a small band on a large mesh, so the
+// run costs the size of the band, besides a few linear passes and the sort of the facets
+
+struct PointGrid {
+    // The points closer than the size of the cells to a point
+    double size;
+    std::unordered_map<uint64_t, std::vector<vec3>> cells;
+
+    explicit PointGrid(double size) : size(size > 0 ? size : 1) {}
+
+    uint64_t key(const vec3& p, int dx, int dy, int dz) const {
+        // 21 bits per coordinate, the cells wrapping around past them
+        uint64_t key = 0;
+        int d[3] = {dx, dy, dz};
+        for (int i = 0; i < 3; i++)
+            key = (key << 21) | (uint64_t(int64_t(std::floor(p[i] / size)) + d[i]) & ((1u << 21) - 1));
+        return key;
+    }
+
+    void add(const vec3& p){
+        cells[key(p, 0, 0, 0)].push_back(p);
+    }
+
+    bool near(const vec3& p) const {
+        for (int dx = -1; dx <= 1; dx++)
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dz = -1; dz <= 1; dz++){
+                    auto cell = cells.find(key(p, dx, dy, dz));
+                    if (cell == cells.end())
+                        continue;
+                    for (const vec3& q : cell->second)
+                        if ((q - p).norm2() <= size*size)
+                            return true;
+                }
+        return false;
+    }
+};
+
+inline double facetSpan(Quads& m, int f){
+    // The longest edge or diagonal of the facet
+    double span = 0;
+    for (int i = 0; i < 4; i++)
+        for (int j = i+1; j < 4; j++)
+            span = std::max(span, (m.points[m.vert(f, i)] - m.points[m.vert(f, j)]).norm());
+    return span;
+}
+
+inline double longestSpan(Quads& m){
+    // The longest edge or diagonal of the facets. A facet closer than d to a point has a vertex closer than d plus it
+    double span = 0;
+    for (int f = 0; f < m.nfacets(); f++)
+        span = std::max(span, facetSpan(m, f));
+    return span;
+}
+
+inline void extractNear(Quads& m, const std::vector<vec3>& points, double radius, Quads& part, std::vector<int>& facets){
+    // Copies in the empty part the facets of m with a vertex closer than radius to one of the points, facets being the facet of m
+    // each one was copied from. The vertices out of the box of the points are skipped at once
+    vec3 min = points[0];
+    vec3 max = points[0];
+    PointGrid grid(radius);
+    for (const vec3& p : points){
+        grid.add(p);
+        for (int i = 0; i < 3; i++){
+            min[i] = std::min(min[i], p[i] - radius);
+            max[i] = std::max(max[i], p[i] + radius);
+        }
+    }
+    std::vector<bool> near(m.nverts());
+    for (int v = 0; v < m.nverts(); v++){
+        const vec3& p = m.points[v];
+        bool inBox = true;
+        for (int i = 0; i < 3; i++)
+            inBox = inBox && p[i] >= min[i] && p[i] <= max[i];
+        near[v] = inBox && grid.near(p);
+    }
+
+    std::vector<int> newId(m.nverts(), -1);
+    std::vector<int> quads;
+    facets.clear();
+    for (int f = 0; f < m.nfacets(); f++){
+        bool isNear = false;
+        for (int i = 0; i < 4; i++)
+            isNear = isNear || near[m.vert(f, i)];
+        if (!isNear)
+            continue;
+        facets.push_back(f);
+        for (int i = 0; i < 4; i++){
+            int& v = newId[m.vert(f, i)];
+            if (v == -1){
+                v = part.points.create_points(1);
+                part.points[v] = m.points[m.vert(f, i)];
+            }
+            quads.push_back(v);
+        }
+    }
+    part.create_facets(quads.size()/4);
+    std::copy(quads.begin(), quads.end(), part.facets.begin());
+}
+
+inline vec3 facetCentroid(Quads& m, int f){
+    vec3 centroid = {0, 0, 0};
+    for (int i = 0; i < 4; i++)
+        centroid += m.points[m.vert(f, i)] / 4;
+    return centroid;
+}
+
+inline std::array<double, 12> facetKey(Quads& m, int f){
+    // The positions of the vertices of the facet in their order around it, from the first one in lexicographic order
+    int first = 0;
+    for (int i = 1; i < 4; i++){
+        const vec3& p = m.points[m.vert(f, i)];
+        const vec3& q = m.points[m.vert(f, first)];
+        if (std::make_tuple(p[0], p[1], p[2]) < std::make_tuple(q[0], q[1], q[2]))
+            first = i;
+    }
+    std::array<double, 12> key;
+    for (int i = 0; i < 4; i++)
+        for (int d = 0; d < 3; d++)
+            key[3*i + d] = m.points[m.vert(f, (first + i) % 4)][d];
+    return key;
+}
+
+inline int changedFacets(Quads& previousInput, Quads& input, std::vector<vec3>& points, std::vector<bool>& removed){
+    // Matches the facets of the inputs by the positions of their vertices, whatever the numbering of the vertices and of the facets. The
+    // vertices and centroids of the facets left unmatched in either one, a vertex of which moved or which were taken out or added, go to
+    // points, and removed flags the ones of previousInput. Returns the number of these facets
+    using Key = std::pair<std::array<double, 12>, int>;
+    std::vector<Key> previousKeys(previousInput.nfacets());
+    std::vector<Key> keys(input.nfacets());
+    for (int f = 0; f < previousInput.nfacets(); f++)
+        previousKeys[f] = {facetKey(previousInput, f), f};
+    for (int f = 0; f < input.nfacets(); f++)
+        keys[f] = {facetKey(input, f), f};
+    std::sort(previousKeys.begin(), previousKeys.end());
+    std::sort(keys.begin(), keys.end());
+
+    removed.assign(previousInput.nfacets(), false);
+    std::vector<bool> added(input.nfacets(), false);
+    size_t i = 0;
+    size_t j = 0;
+    while (i < previousKeys.size() || j < keys.size()){
+        if (j == keys.size() || (i < previousKeys.size() && previousKeys[i].first < keys[j].first))
+            removed[previousKeys[i++].second] = true;
+        else if (i == previousKeys.size() || keys[j].first < previousKeys[i].first)
+            added[keys[j++].second] = true;
+        else {
+            i++;
+            j++;
+        }
+    }
+
+    int nbChanged = 0;
+    points.clear();
+    for (auto [m, changed] : {std::pair<Quads*, std::vector<bool>*>{&previousInput, &removed}, {&input, &added}})
+        for (int f = 0; f < m->nfacets(); f++){
+            if (!(*changed)[f])
+                continue;
+            nbChanged++;
+            for (int k = 0; k < 4; k++)
+                points.push_back(m->points[m->vert(f, k)]);
+            points.push_back(facetCentroid(*m, f));
+        }
+    return nbChanged;
+}
+
+inline void growBand(Quads& m, std::vector<bool>& selection, int rings){
+    // Adds to the selection the facets sharing a vertex with it, rings times
+    std::vector<bool> inBand(m.nverts(), false);
+    for (int ring = 0; ring < rings; ring++){
+        for (int f = 0; f < m.nfacets(); f++)
+            if (selection[f])
+                for (int i = 0; i < 4; i++)
+                    inBand[m.vert(f, i)] = true;
+        for (int f = 0; f < m.nfacets(); f++)
+            for (int i = 0; i < 4; i++)
+                selection[f] = selection[f] || inBand[m.vert(f, i)];
+    }
+}
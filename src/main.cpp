@@ -1,234 +1,96 @@
 #include "ultimaille/attributes.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
-#include <numbers>
+#include <memory>
+#include <new>
 #include <string>
+#include <thread>
+#include <vector>
 #include <ultimaille/all.h>
-#include <list>
-#include "patchFinding.h"
-#include "remeshing.h"
+#include "batch.h"
+#include "bunin.h"
+#include "mainLoop.h"
+#include "profiling.h"
+#include "sweep.h"
 #include <filesystem>
 #include "param_parser.h"
-#include "ultimaille/primitive_geometry.h"
-#include "ultimaille/surface.h"
 
 using namespace UM;
-using Halfedge = typename Surface::Halfedge;
-using Facet = typename Surface::Facet;
-using Vertex = typename Surface::Vertex;
-
-void animate(Quads& m, int i, std::string path){
-    std::cout << "animate: " << i << " | ";
-    std::string number = std::to_string(i);
-    if (i < 10){
-        number = "000" + number;
-    }
-    else if (i < 100){
-        number = "00" + number;
-    }
-    else if (i < 1000){
-        number = "0" + number;
-    }
-    std::string s = path + "/" + number + ".geogram";
-    write_by_extension(s, m);
-}
-
-int countDefect(Quads& m){
-    int count = 0;
-    for (Vertex v: m.iter_vertices()){
-        if (getValence(v) != 4){
-            count++;
-        }
-    }
-    return count;
-}
-
-Triangles quand2tri(Quads& m){
-    Triangles m2;
-    m2.points.create_points(m.nverts());
-    for(Vertex v : m.iter_vertices()){
-        m2.points[v]= v.pos();
-    }
-    m2.create_facets(m.nfacets()*2);
-    for (auto f: m.iter_facets()){
-        m2.vert(2*f, 0) = m.vert(f, 0);
-        m2.vert(2*f, 1) = m.vert(f, 1);
-        m2.vert(2*f, 2) = m.vert(f, 2);
-
-        m2.vert(2*f+1, 0) = m.vert(f, 0);
-        m2.vert(2*f+1, 1) = m.vert(f, 2);
-        m2.vert(2*f+1, 2) = m.vert(f, 3);
-    }
-    return m2;
-}
 
-bool loadingInput(Quads& m, std::string path){
-    read_by_extension(path, m);
-
-    if (m.nverts() == 0) {
-        std::cerr << "Error reading file" << std::endl;
-        return false;
-    }
-
-    m.connect();
-    return true;
+#ifdef BUNIN_HEAP_ACCOUNTING
+// Counting the allocations of the run for the memory report, only built with the BUNIN_HEAP_ACCOUNTING option of CMake, and only counted when
+// a report is asked for. It covers this executable alone: the programs using the bunin library keep their own operators.
+// The size of each block, and whether it was counted, are kept in front of it, so the live bytes are known when it is freed.
+// The array and nothrow versions call these ones
+struct BlockHeader {
+    std::size_t size;
+    bool counted;
+};
+static_assert(sizeof(BlockHeader) <= sizeof(std::max_align_t));
+
+void* operator new(std::size_t size){
+    char* block = static_cast<char*>(std::malloc(size + sizeof(std::max_align_t)));
+    if (block == nullptr)
+        throw std::bad_alloc();
+    BlockHeader* header = reinterpret_cast<BlockHeader*>(block);
+    header->size = size;
+    header->counted = heapCounters.counting.load(std::memory_order_relaxed);
+    if (header->counted)
+        heapCounters.allocated(size);
+    return block + sizeof(std::max_align_t);
 }
 
-void edgeFlipping(Quads& m, CornerAttribute<int>& ca){
-
-    bool hasFlipped = true;
-    int max_iter = 20;
-    while (hasFlipped && max_iter > 0){
-        max_iter--;
-        hasFlipped = false;
-        for (Halfedge he: m.iter_halfedges()){
-
-            if (ca[he] == 1)
-                continue;
-
-            Vertex a = he.from();
-            Vertex b = he.to();
-            int NEa = getValence(a);
-            int NEb = getValence(b);
-            if (NEa + NEb >= 9){
-                Vertex d = he.next().to();
-                Vertex f = he.next().next().to();
-                Vertex c = he.opposite().next().to();
-                Vertex e = he.opposite().next().next().to();
-
-                int NEc = getValence(c);
-                int NEe = getValence(e);
-                int NEd = getValence(d);
-                int NEf = getValence(f);
-
-                // Zhu, J.Z., Zienkiewicz, O.C., Hinton, E. and Wu, J. (1991), A new approach to the development of automatic quadrilateral mesh generation. Int. J. Numer. Meth. Engng., 32: 849-866. https://doi.org/10.1002/nme.1620320411
-                // page 180
-                if ((NEa + NEb) - (NEc + NEd) >= (NEa + NEb) - (NEe + NEf) && (NEa + NEb) - (NEc + NEd) >= 3){ 
-                    int facet1 = he.facet();
-                    int facet2 = he.opposite().facet();
-
-                    for (Halfedge h: Facet(m, facet1).iter_halfedges())
-                        if (ca[h] == 1)
-                            continue;
-                    for (Halfedge h: Facet(m, facet2).iter_halfedges())
-                        if (ca[h] == 1)
-                            continue;
-                    
-                    // New quad creation
-                    m.conn->create_facet({c, e, b, d});
-                    m.conn->create_facet({c, d, f, a});
-
-                    // Cleanup
-                    m.conn.get()->active[facet1] = false;
-                    m.conn.get()->active[facet2] = false;
-
-                    hasFlipped = true;
-                    m.compact(true);
-                }
-            }
-        }
-    }
-    assert(max_iter > 0);
+void operator delete(void* ptr) noexcept {
+    if (ptr == nullptr)
+        return;
+    BlockHeader* header = reinterpret_cast<BlockHeader*>(static_cast<char*>(ptr) - sizeof(std::max_align_t));
+    if (header->counted)
+        heapCounters.freed(header->size);
+    std::free(header);
 }
 
-void markHardEdges(Quads& m, CornerAttribute<int>& hardEdges){
-    for (Halfedge he: m.iter_halfedges()){
-
-        if (he.opposite() == -1 || hardEdges[he] == 1){
-            hardEdges[he] = 1;
-            continue;
-        }
-        
-        vec3 n1 = he.facet().geom<Quad3>().normal();
-        vec3 n2 = he.opposite().facet().geom<Quad3>().normal();
-        n1.normalize();
-        n2.normalize();
-        double ndot = (n1.x*n2.x + n1.y*n2.y + n1.z*n2.z); 
-        double angle = atan2(cross(n1,n2).norm(), ndot);
-
-        if (angle >= std::numbers::pi/4){
-            hardEdges[he] = 1;
-            hardEdges[he.opposite()] = 1;
-        }
-    }
+void operator delete(void* ptr, std::size_t) noexcept {
+    operator delete(ptr);
 }
+#endif
 
-void mainLoop(Quads& m, BVH& bvh, FacetAttribute<int>& fa, bool ANIMATE, std::string animationPath, int MAXPATCHSIZE, CornerAttribute<int>& ca, bool CAD_MODE, bool EDGE_FLIP = true){
-
-    if (CAD_MODE)
-        markHardEdges(m, ca);
-
-    if (EDGE_FLIP)
-        edgeFlipping(m, ca);
-
-    int i = 0;
-    while(true){
-        i++;
-        bool hasRemeshed = false;
-        
-        // iterating through the vertices until finding a defect 
-        for (Vertex v: m.iter_vertices()){
-            fa.fill(0);
-
-            if (getValence(v) == 4)
-                continue;
-
-            if (ca[v.halfedge()] == 1 ||
-                ca[v.halfedge().next()] == 1 ||
-                ca[v.halfedge().next().next()] == 1 ||
-                ca[v.halfedge().next().next().next()] == 1)
-                continue;
-            
-            std::list<int> patch; 
-            std::list<int> patchConvexity;
-            int edgeCount = initialPatchConstruction(v, fa, patch, patchConvexity, m, ca);
-            if (edgeCount == -1)
-                continue;
-
-            // trying to remesh and expanding the patch in case of failure, until we reach the maximum patch size
-            int facetCount = 0;
-            int max_iter = 20;
-            while (facetCount < MAXPATCHSIZE && max_iter > 0){
-                
-                if ( edgeCount == 4 || edgeCount == 3 || edgeCount == 5){
-                    if(remeshingPatch(patch, patchConvexity, edgeCount, m, fa, v, bvh)){
-                        hasRemeshed = true;
-                        break;
-                    }
-                }
-
-                edgeCount = expandPatch(patch, fa, m, patchConvexity, ca);
-                if (edgeCount == -1){
-                    break; 
-                }
-
-                facetCount = countFacetsInsidePatch(fa, m.nfacets());
-                max_iter--;
-            }
-
-            if (hasRemeshed){
-                if (ANIMATE)
-                    animate(m, i, animationPath);
-                break;
-            }
-        }
-
-        if (!hasRemeshed){
-            std::cout << "No more valid patch found." << std::endl;
-            break;
-        }
-    }
-}
+static std::atomic<bool> interrupted = false;
 
 int main(int argc, char* argv[]) {
     Parameters params;
     params.help = "This addon correct defects in a quad mesh.";
     params.add("input", "model", "").description("Model to process");
     params.add("string", "result_path", "").type_of_param("system");
-    params.add("bool", "animate", "false").description("Export the mesh after each iteration");
+    params.add("bool", "animate", "false").description("Log the remeshes in result_path/{model}.anim, to be expanded by the expand tool");
     params.add("int", "maxPatchSize", "500").description("Maximum number of facets in a patch to remesh");
     params.add("bool", "cad_mode", "false").description("Respect the sharp angles of the mesh");
     params.add("bool", "edge_flipping", "true").description("Enable edge flipping");
+    params.add("bool", "reject_inverted", "false").description("Reject the remeshes with quads facing the wrong side of the surface");
+    params.add("bool", "reject_worse_valence", "false").description("Reject the remeshes raising the summed distance to valence 4 of the vertices of the patch");
+    params.add("int", "smooth_iterations", "0").description("Number of smoothing iterations after the remeshing");
+    params.add("string", "report", "").description("Write the timings and counters of the run to this json file");
+    params.add("string", "trace", "").description("Write the timeline of the run to this json file, in the Chrome trace format");
+    params.add("enum", "seeding", "field").possible_values("field,bfs").description("Start the patches with the 2 defects closest to each one in a distance field, or with a breadth-first search to 3 defects");
+    params.add("enum", "order", "input").possible_values("input,morton,hilbert").description("Reorder the vertices and facets along a space filling curve, for locality");
+    params.add("int", "reorder_every", "0").description("With an order, reorder the mesh again after that many remeshes, 0 for never");
+    params.add("double", "time_budget", "0").description("Stop the remeshing after this many seconds, 0 for no limit");
+    params.add("int", "iteration_budget", "0").description("Stop the remeshing after this many remeshed patches, 0 for no limit");
+    params.add("enum", "smooth_region", "remeshed").possible_values("remeshed,all").description("Smooth only the remeshed patches, or the whole mesh");
+    params.add("string", "batch", "").description("Process all the meshes of this directory, or the ones listed in this file, instead of model");
+    params.add("string", "cache", "").description("Directory where to keep a binary copy of the input meshes, read instead of them by the next runs");
+    params.add("string", "sweep", "").description("Run these parameter values on model, e.g. maxPatchSize:100,300;cad_mode:false,true;seeding:field,bfs, and keep the best result");
+    params.add(Parameters::Type::FacetsBool(1), "selection", "").description("Only remesh the facets of this attribute of the model");
+    params.add(Parameters::Type::VerticesBool(1), "vertex_selection", "").description("Only remesh the facets touching the vertices of this attribute of the model");
+    params.add("string", "previous_input", "").description("Previous version of model: only remesh around the changes since, reusing previous_result away from them");
+    params.add("string", "previous_result", "").description("Result of the remeshing of previous_input");
+    params.add("int", "band", "2").description("Rings of facets around the changes remeshed again with previous_input");
+    params.add("int", "jobs", "0").description("Number of meshes, or of sweep runs, processed at the same time, 0 for the number of cores");
     params.init_from_args(argc, argv);
 
     std::string filename = params["model"];
@@ -237,44 +99,213 @@ int main(int argc, char* argv[]) {
     int MAXPATCHSIZE = params["maxPatchSize"];
     bool CAD_MODE = params["cad_mode"];
     bool EDGE_FLIP = params["edge_flipping"];
+    bool REJECT_INVERTED = params["reject_inverted"];
+    bool REJECT_WORSE_VALENCE = params["reject_worse_valence"];
+    int SMOOTH_ITERATIONS = params["smooth_iterations"];
+    std::string SMOOTH_REGION = params["smooth_region"];
+    std::string ORDER = params["order"];
+    int REORDER_EVERY = params["reorder_every"];
+    std::string SEEDING = params["seeding"];
+    double TIME_BUDGET = params["time_budget"];
+    int ITERATION_BUDGET = params["iteration_budget"];
+    std::string REPORT = params["report"];
+    std::string TRACE = params["trace"];
+    std::string BATCH = params["batch"];
+    std::string SWEEP = params["sweep"];
+    std::string CACHE = params["cache"];
+    std::string SELECTION = params["selection"];
+    std::string VERTEX_SELECTION = params["vertex_selection"];
+    std::string PREVIOUS_INPUT = params["previous_input"];
+    std::string PREVIOUS_RESULT = params["previous_result"];
+    int BAND = params["band"];
+    int JOBS = params["jobs"];
+    profiler.enabled = !REPORT.empty();
+    profiler.tracing = !TRACE.empty();
+#ifdef BUNIN_HEAP_ACCOUNTING
+    heapCounters.counting = profiler.enabled;
+#endif
+
+    bunin::Options options;
+    options.maxPatchSize = MAXPATCHSIZE;
+    options.cadMode = CAD_MODE;
+    options.edgeFlipping = EDGE_FLIP;
+    options.rejectInverted = REJECT_INVERTED;
+    options.rejectWorseValence = REJECT_WORSE_VALENCE;
+    options.smoothIterations = SMOOTH_ITERATIONS;
+    options.smoothAll = SMOOTH_REGION == "all";
+    options.seeding = SEEDING == "bfs" ? bunin::Seeding::BreadthFirst : bunin::Seeding::NearestDefects;
+    options.order = ORDER == "hilbert" ? bunin::Order::Hilbert : ORDER == "morton" ? bunin::Order::Morton : bunin::Order::Input;
+    options.reorderEvery = REORDER_EVERY;
+    options.timeBudget = TIME_BUDGET;
+    options.iterationBudget = ITERATION_BUDGET;
+    options.band = BAND;
+    options.cancel = &interrupted;
+    int nbThreads = JOBS > 0 ? JOBS : std::max(1u, std::thread::hardware_concurrency());
+    if (!CACHE.empty() && CacheHeader().ultimaille[0] == 0){
+        std::cerr << "Warning: this build doesn't know the commit of ultimaille its cache would depend on, the cache isn't used" << std::endl;
+        CACHE.clear();
+    }
+
+    if (!BATCH.empty()){
+        // One process for all the meshes, so the start up and the scratch buffers of the remeshing are paid once per worker thread.
+        // The report and the trace are about a single run, so they aren't written
+        profiler.enabled = false;
+        profiler.tracing = false;
+        heapCounters.counting = false;
+
+        std::vector<std::string> models = batchModels(BATCH);
+        if (models.empty()){
+            std::cerr << "Error: no mesh found in " << BATCH << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (result_path.empty())
+            result_path = "output/batch";
+        std::filesystem::create_directories(result_path);
+
+        // Ctrl+C lets the meshes being processed stop and be written, and skips the others
+        std::signal(SIGINT, [](int){ interrupted = true; });
+        auto start = std::chrono::steady_clock::now();
+        std::vector<BatchResult> results = runBatch(models, result_path, CACHE, options, nbThreads);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::signal(SIGINT, SIG_DFL);
+
+        std::string resultsFile = (result_path / "results.json").string();
+        if (writeBatchResults(resultsFile, results, seconds))
+            std::cout << "Results of " << results.size() << " meshes exported in " << resultsFile << std::endl;
+        else
+            std::cerr << "Error: can't write the results in " << resultsFile << std::endl;
+
+        bool failed = std::any_of(results.begin(), results.end(), [](const BatchResult& result){ return result.failed(); });
+        return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
 
     Quads m;
-    if (!loadingInput(m, filename))
+    // in cad mode, a whole mesh comes with its hard edges, from the cache when there is one, and the run doesn't mark them again
+    std::unique_ptr<CornerFlags> inputHardEdges;
+    if (CAD_MODE && SELECTION.empty() && VERTEX_SELECTION.empty() && PREVIOUS_INPUT.empty() && SWEEP.empty())
+        inputHardEdges = std::make_unique<CornerFlags>(m);
+    ScopedTimer loadingTimer("loadingInput");
+    bool loaded = SELECTION.empty() && VERTEX_SELECTION.empty() ? loadingInput(m, filename, CACHE, inputHardEdges.get()) : loadingSelection(m, filename, SELECTION, VERTEX_SELECTION, options.selection, CACHE);
+    if (!loaded)
         return EXIT_SUCCESS;
-
-    int defectCountBefore = countDefect(m);
-
-    FacetAttribute<int> fa(m, 0);
-    CornerAttribute<int> hardEdges(m, 0);
+    Quads previousInput;
+    Quads previousResult;
+    if (!PREVIOUS_INPUT.empty() && (!loadingInput(previousInput, PREVIOUS_INPUT, CACHE) || !loadingInput(previousResult, PREVIOUS_RESULT, CACHE)))
+        return EXIT_SUCCESS;
+    loadingTimer.stop();
+    profiler.structure("input Quads", meshBytes(m));
 
     if (result_path.empty() && !std::filesystem::is_directory("output")) {
         std::filesystem::create_directories("output");
         result_path = "output";
     }
-    std::string animationPath = result_path.string()+"/animation";
 
-    if (ANIMATE && !std::filesystem::is_directory(animationPath)) {
-        std::cerr << "Error: " << result_path << " is not a directory" << std::endl;
-        std::filesystem::create_directories(animationPath);
+    if (!SWEEP.empty()){
+        // The configurations share the loaded mesh and its projection structure, and run in parallel on copies of it. Only the best result is written
+        profiler.enabled = false;
+        profiler.tracing = false;
+        heapCounters.counting = false;
+
+        std::vector<SweepRun> runs;
+        if (!sweepRuns(SWEEP, options, runs))
+            return EXIT_FAILURE;
+        std::filesystem::create_directories(result_path);
+
+        std::signal(SIGINT, [](int){ interrupted = true; });
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<SweepMesh> best;
+        int bestRun = runSweep(m, runs, nbThreads, best);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::signal(SIGINT, SIG_DFL);
+
+        std::string resultsFile = (result_path / "sweep.json").string();
+        if (writeSweepResults(resultsFile, filename, runs, bestRun, seconds))
+            std::cout << "Results of " << runs.size() << " runs exported in " << resultsFile << std::endl;
+        else
+            std::cerr << "Error: can't write the results in " << resultsFile << std::endl;
+
+        if (bestRun == -1){
+            std::cerr << "Error: no run succeeded" << std::endl;
+            return EXIT_FAILURE;
+        }
+        // written in the background while the best run is printed, as the single run does below
+        std::string out_filename = (result_path / std::filesystem::path(filename).filename()).string();
+        BackgroundWriter writer(1);
+        writer.push([&](){
+            write_by_extension(out_filename, best->m, {{}, {{"patch", best->patch.ptr}, }, {{"hardedges", best->hardEdges.ptr},}});
+        });
+        std::cout << "Best run: " << runs[bestRun].name() << std::endl;
+        if (!writer.flush()){
+            std::cerr << "Error: can't write the result in " << out_filename << ", " << writer.error << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "Result exported in " << out_filename << std::endl;
+
+        const bunin::Result& result = runs[bestRun].result;
+        return 100*(result.defectsBefore - result.defectsAfter)/std::max(1, result.defectsBefore);
+    }
+
+    FacetAttribute<int> fa(m, 0);
+    CornerAttribute<int> hardEdges(m, 0);
+    if (inputHardEdges){
+        storeAttribute(*inputHardEdges, hardEdges);
+        inputHardEdges.reset();
+        options.cadMode = false;
     }
+    std::string animationPath = (result_path / std::filesystem::path(filename).stem()).string() + ".anim";
+
+    if (ANIMATE && !std::filesystem::is_directory(result_path))
+        std::filesystem::create_directories(result_path);
 
     /////////////////////////////////////////////////////////////////////////////////
 
-    // Constructing structure for projecting the new patches on the original mesh
-    Triangles mTri = quand2tri(m);
-    BVH bvh(mTri);  
-    mainLoop(m, bvh, fa, ANIMATE, animationPath, MAXPATCHSIZE, hardEdges, CAD_MODE, EDGE_FLIP);
+    options.verbose = true;
+    if (ANIMATE)
+        options.animationPath = animationPath;
+
+    // Ctrl+C stops the remeshing, and the mesh obtained so far is still written
+    std::signal(SIGINT, [](int){ interrupted = true; });
+    bunin::Result result = PREVIOUS_INPUT.empty() ? bunin::remesh(m, options, fa, hardEdges) : bunin::update(previousInput, previousResult, m, options, fa, hardEdges);
+    std::signal(SIGINT, SIG_DFL);
+    int defectCountBefore = result.defectsBefore;
 
     /////////////////////////////////////////////////////////////////////////////////
 
+    // The output is written in the background while the results are printed, the timer only counting the time left to wait for it.
+    // The report and the trace come after, as they hold that timer
     std::string file = std::filesystem::path(filename).filename().string();
     std::string out_filename = (result_path / file).string();
-    write_by_extension(out_filename, m, {{}, {{"patch", fa.ptr}, }, {{"hardedges", hardEdges.ptr},}});
-    std::cout << "Result exported in " << out_filename << std::endl;
+    BackgroundWriter writer(1);
+    writer.push([&](){
+        write_by_extension(out_filename, m, {{}, {{"patch", fa.ptr}, }, {{"hardedges", hardEdges.ptr},}});
+    });
 
-    int defectCountAfter = countDefect(m);
-    int percent = 100*(defectCountBefore-defectCountAfter)/defectCountBefore;
+    int defectCountAfter = result.defectsAfter;
+    int percent = 100*(defectCountBefore-defectCountAfter)/std::max(1, defectCountBefore);
     std::cout << "Number of corrected defects: " << defectCountBefore-defectCountAfter << " out of " << defectCountBefore << " (" << percent << ")" << std::endl;
 
+    ScopedTimer outputTimer("write_by_extension");
+    bool written = writer.flush();
+    outputTimer.stop();
+    if (written)
+        std::cout << "Result exported in " << out_filename << std::endl;
+    else
+        std::cerr << "Error: can't write the result in " << out_filename << ", " << writer.error << std::endl;
+
+    if (profiler.enabled){
+        if (profiler.writeReport(REPORT, filename, defectCountBefore, defectCountAfter))
+            std::cout << "Report exported in " << REPORT << std::endl;
+        else
+            std::cerr << "Error: can't write the report in " << REPORT << std::endl;
+        profiler.printAttempts(std::cout);
+    }
+
+    if (profiler.tracing){
+        if (profiler.writeTrace(TRACE))
+            std::cout << "Trace exported in " << TRACE << std::endl;
+        else
+            std::cerr << "Error: can't write the trace in " << TRACE << std::endl;
+    }
+
     return percent;
 }
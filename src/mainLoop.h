@@ -0,0 +1,407 @@
+#pragma once
+
+#include "ultimaille/attributes.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <numbers>
+#include <string>
+#include <ultimaille/all.h>
+#include <list>
+#include "patchFinding.h"
+#include "animation.h"
+#include "remeshing.h"
+#include "profiling.h"
+#include "reader.h"
+#include "reordering.h"
+#include "ultimaille/primitive_geometry.h"
+#include "ultimaille/surface.h"
+
+using namespace UM;
+using Halfedge = typename Surface::Halfedge;
+using Facet = typename Surface::Facet;
+using Vertex = typename Surface::Vertex;
+
+inline int countDefect(Quads& m){
+    int count = 0;
+    for (Vertex v: m.iter_vertices()){
+        if (getValence(v) != 4){
+            count++;
+        }
+    }
+    return count;
+}
+
+struct RunControl {
+    // Limits of a run and its cancellation, checked between the iterations of the main loop, the attempts at each defect and the expansions of the patches.
+    // The mesh is only changed by committed remeshes, so it is valid, and has the fewest defects so far, wherever the run stops
+    double timeBudget = 0;                      // seconds, none if 0
+    int iterationBudget = 0;                    // none if 0
+    const std::atomic<bool>* cancel = nullptr;  // set from another thread or a signal handler to stop the run
+    std::function<bool(int defects, int iterations, double seconds)> progress; // called after each remesh, the run stops if it returns false
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const char* stopped = nullptr;              // why the run stopped before its end
+
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool interrupted(){
+        if (stopped == nullptr && cancel != nullptr && cancel->load(std::memory_order_relaxed))
+            stopped = "cancelled";
+        if (stopped == nullptr && timeBudget > 0 && seconds() > timeBudget)
+            stopped = "time budget reached";
+        return stopped != nullptr;
+    }
+
+    void remeshed(Quads& m, int iterations){
+        if (progress && !progress(countDefect(m), iterations, seconds()))
+            stopped = "cancelled";
+        if (stopped == nullptr && iterationBudget > 0 && iterations >= iterationBudget)
+            stopped = "iteration budget reached";
+    }
+};
+
+inline long meshBytes(Surface& m){
+    // Points and facets, plus the connectivity when built: the facet and the next corner around the vertex of each corner, a corner per vertex and a flag per facet.
+    // Only counts the sizes, the capacities of the vectors are not reachable
+    long corners = m.facets.size();
+    long bytes = m.nverts()*sizeof(vec3) + corners*sizeof(int);
+    if (m.conn)
+        bytes += 2*corners*sizeof(int) + m.nverts()*sizeof(int) + m.nfacets()/8;
+    return bytes;
+}
+
+inline Triangles quand2tri(Quads& m){
+    Triangles m2;
+    m2.points.create_points(m.nverts());
+    for(Vertex v : m.iter_vertices()){
+        m2.points[v]= v.pos();
+    }
+    m2.create_facets(m.nfacets()*2);
+    for (auto f: m.iter_facets()){
+        m2.vert(2*f, 0) = m.vert(f, 0);
+        m2.vert(2*f, 1) = m.vert(f, 1);
+        m2.vert(2*f, 2) = m.vert(f, 2);
+
+        m2.vert(2*f+1, 0) = m.vert(f, 0);
+        m2.vert(2*f+1, 1) = m.vert(f, 2);
+        m2.vert(2*f+1, 2) = m.vert(f, 3);
+    }
+    return m2;
+}
+
+inline bool loadingInput(Quads& m, std::string path, std::string cacheDir = "", CornerFlags* hardEdges = nullptr){
+    // see readInput for the cache, the readers and the connectivity
+    if (!readInput(m, path, cacheDir, hardEdges)) {
+        std::cerr << "Error reading file" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+inline bool loadingSelection(Quads& m, std::string path, std::string facetAttribute, std::string vertexAttribute, std::vector<bool>& selection, std::string cacheDir = ""){
+    // see readSelection
+    if (!readSelection(m, path, facetAttribute, vertexAttribute, selection, cacheDir)) {
+        if (m.nverts() == 0)
+            std::cerr << "Error reading file" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+inline void edgeFlipping(Quads& m, CornerFlags& ca, FacetFlags* frozen = nullptr){
+
+    bool hasFlipped = true;
+    int max_iter = 20;
+    while (hasFlipped && max_iter > 0){
+        max_iter--;
+        hasFlipped = false;
+        for (Halfedge he: m.iter_halfedges()){
+
+            // an edge on the border of the mesh has a single facet, there is nothing to flip
+            if (ca[he] == 1 || he.opposite() == -1)
+                continue;
+
+            // the facets created by the flips next to the frozen ones don't have the wall on their side
+            if (frozen != nullptr && ((*frozen)[he.facet()] == 1 || (*frozen)[he.opposite().facet()] == 1))
+                continue;
+
+            Vertex a = he.from();
+            Vertex b = he.to();
+            int NEa = getValence(a);
+            int NEb = getValence(b);
+            if (NEa + NEb >= 9){
+                Vertex d = he.next().to();
+                Vertex f = he.next().next().to();
+                Vertex c = he.opposite().next().to();
+                Vertex e = he.opposite().next().next().to();
+
+                int NEc = getValence(c);
+                int NEe = getValence(e);
+                int NEd = getValence(d);
+                int NEf = getValence(f);
+
+                // Zhu, J.Z., Zienkiewicz, O.C., Hinton, E. and Wu, J. (1991), A new approach to the development of automatic quadrilateral mesh generation. Int. J. Numer. Meth. Engng., 32: 849-866. https://doi.org/10.1002/nme.1620320411
+                // page 180
+                if ((NEa + NEb) - (NEc + NEd) >= (NEa + NEb) - (NEe + NEf) && (NEa + NEb) - (NEc + NEd) >= 3){ 
+                    int facet1 = he.facet();
+                    int facet2 = he.opposite().facet();
+
+                    for (Halfedge h: Facet(m, facet1).iter_halfedges())
+                        if (ca[h] == 1)
+                            continue;
+                    for (Halfedge h: Facet(m, facet2).iter_halfedges())
+                        if (ca[h] == 1)
+                            continue;
+                    
+                    // New quad creation
+                    m.conn->create_facet({c, e, b, d});
+                    m.conn->create_facet({c, d, f, a});
+
+                    // Cleanup
+                    m.conn.get()->active[facet1] = false;
+                    m.conn.get()->active[facet2] = false;
+
+                    hasFlipped = true;
+                    profiler.structure("Quads before compaction", meshBytes(m));
+                    ScopedTimer timer("m.compact");
+                    m.compact(true);
+                }
+            }
+        }
+    }
+    assert(max_iter > 0);
+}
+
+inline void markFrozenWalls(Quads& m, FacetFlags& frozen, CornerFlags& ca){
+    // The edges of the frozen facets are walls on both sides, like hard edges, so the defect field and the patches stop at them.
+    // The facets a remesh creates along them don't have it on their side, so it is marked again after each remesh
+    forEachNonZero(frozen, [&](int f, int){
+        for (Halfedge he : Facet(m, f).iter_halfedges()){
+            ca[he] = 1;
+            if (he.opposite() != -1)
+                ca[he.opposite()] = 1;
+        }
+        return true;
+    });
+}
+
+inline bool touchesFrozen(Vertex v, FacetFlags& frozen){
+    Halfedge he = v.halfedge();
+    for (int i = 0; i < MAX_VALENCE; i++){
+        if (frozen[he.facet()] == 1 || he.opposite() == -1)
+            return true;
+        he = he.opposite().next();
+        if (he == v.halfedge())
+            return false;
+    }
+    return true;
+}
+
+struct LoopSettings {
+    // What the main loop does besides remeshing the defects, see bunin::Options
+    std::string animationPath;              // file where to log the remeshes, none if empty
+    int maxPatchSize = 500;
+    bool cadMode = false;
+    bool edgeFlipping = true;
+    bool rejectInverted = false;
+    bool rejectWorseValence = false;
+    CurveOrder order = CurveOrder::none;
+    int reorderEvery = 0;
+    PatchSeeding seeding = PatchSeeding::field;
+    RunControl* control = nullptr;          // limits and cancellation of the run, none if null
+    FacetFlags* frozen = nullptr;           // facets never remeshed, see region.h
+};
+
+inline int mainLoop(Quads& m, BVH& bvh, FacetStates& fa, FacetFlags& remeshed, CornerFlags& ca, const LoopSettings& settings = {}){
+    // Returns the number of iterations, each one ending with a remesh but the last one of a run that wasn't stopped
+
+    if (settings.cadMode){
+        ScopedTimer timer("markHardEdges");
+        markHardEdges(m, ca);
+    }
+
+    FacetFlags* frozen = settings.frozen;
+    RunControl* control = settings.control;
+    if (frozen != nullptr)
+        markFrozenWalls(m, *frozen, ca);
+
+    if (settings.edgeFlipping){
+        ScopedTimer timer("edgeFlipping");
+        edgeFlipping(m, ca, frozen);
+        if (frozen != nullptr)
+            markFrozenWalls(m, *frozen, ca);
+    }
+
+    // after the compaction of the edge flipping, and before the structures of the loop are built on the vertices. The remeshed patches
+    // are then appended at the end, so with reorderEvery the mesh is reordered again after that many remeshes
+    if (settings.order != CurveOrder::none){
+        ScopedTimer timer("reorder");
+        if (!reorder(m, settings.order) && verbose)
+            std::cout << "The mesh has attributes that can't be reordered, it is left in its order" << std::endl;
+    }
+
+    // built once, then only updated around each remeshed patch
+    ScopedTimer fieldTimer("DefectField");
+    DefectField field(m, ca, settings.seeding);
+    fieldTimer.stop();
+    profiler.structure("DefectField", field.bytes());
+    PatchOutline outline(m);
+
+    // the facets created from now on are at 1, as it is the default value of the attribute
+    remeshed.fill(0);
+
+    // the remeshes are logged as they are committed, see animation.h
+    AnimationLog log;
+    AnimationLog* previousLog = animationLog;
+    if (!settings.animationPath.empty()){
+        if (log.open(settings.animationPath, m))
+            animationLog = &log;
+        else
+            std::cerr << "Error: can't write the animation in " << settings.animationPath << std::endl;
+    }
+
+    int i = 0;
+    while(control == nullptr || control->stopped == nullptr){
+        i++;
+        bool hasRemeshed = false;
+        ScopedTimer iterationTimer("iteration");
+        if (profiler.tracing)
+            iterationTimer.args = "{\"i\": " + std::to_string(i) + "}";
+        
+        // iterating through the vertices until finding a defect 
+        for (Vertex v: m.iter_vertices()){
+            fa.fill(0);
+
+            if (getValence(v) == 4)
+                continue;
+
+            // its patch would start with the frozen facets around it
+            if (frozen != nullptr && touchesFrozen(v, *frozen))
+                continue;
+
+            if (ca[v.halfedge()] == 1 ||
+                ca[v.halfedge().next()] == 1 ||
+                ca[v.halfedge().next().next()] == 1 ||
+                ca[v.halfedge().next().next().next()] == 1)
+                continue;
+
+            if (control != nullptr && control->interrupted())
+                break;
+            
+            std::list<int> patch; 
+            std::list<int> patchConvexity;
+            std::vector<int> segments;
+            profiler.count("defects attempted");
+            PatchAttempt attempt(v);
+            ScopedTimer constructionTimer("initialPatchConstruction");
+            int edgeCount = initialPatchConstruction(v, field, fa, patch, patchConvexity, segments, m, ca, outline);
+            constructionTimer.stop();
+            if (edgeCount == -1){
+                attempt.end(patchFailure, profiler.active() ? countFacetsInsidePatch(fa) : 0, 0);
+                continue;
+            }
+
+            // trying to remesh and expanding the patch in case of failure, until we reach the maximum patch size
+            // the side lengths are known right after each expansion, a shape that Bunin's equations can't solve (edgeCount of 0) going straight to the next expansion
+            int facetCount = 0;
+            int max_iter = 20;
+            int expansions = 0;
+            int patchSize = 0;
+            const char* outcome = nullptr;
+            while (facetCount < settings.maxPatchSize && max_iter > 0){
+                if (control != nullptr && control->interrupted()){
+                    outcome = control->stopped;
+                    break;
+                }
+                
+                if (edgeCount > 0){
+                    if (frozen != nullptr && checkFrozen(fa, *frozen) == -1){
+                        outcome = patchFailure;
+                        break;
+                    }
+
+                    if (profiler.active())
+                        patchSize = countFacetsInsidePatch(fa);
+                    ScopedTimer remeshTimer("remeshingPatch");
+                    if(remeshingPatch(patch, patchConvexity, segments, m, fa, v, bvh, settings.rejectInverted, settings.rejectWorseValence)){
+                        hasRemeshed = true;
+                        outcome = "remeshed";
+                        break;
+                    }
+                } else {
+                    profiler.count("unsolvable shapes");
+                }
+
+                ScopedTimer expansionTimer("expandPatch");
+                profiler.count("patch expansions");
+                expansions++;
+                edgeCount = expandPatch(patch, fa, m, patchConvexity, segments, ca, outline);
+                expansionTimer.stop();
+                if (edgeCount == -1){
+                    outcome = patchFailure;
+                    break; 
+                }
+
+                facetCount = countFacetsInsidePatch(fa);
+                max_iter--;
+            }
+
+            if (outcome == nullptr)
+                outcome = facetCount >= settings.maxPatchSize ? "maxPatchSize reached" : "max_iter reached";
+            if (!hasRemeshed && profiler.active())
+                patchSize = countFacetsInsidePatch(fa);
+            attempt.end(outcome, patchSize, expansions);
+
+            if (hasRemeshed){
+                if (frozen != nullptr)
+                    markFrozenWalls(m, *frozen, ca);
+                ScopedTimer updateTimer("DefectField::update");
+                field.update();
+                updateTimer.stop();
+                // the field and the attributes of the loop are bound to the mesh, so they follow it, but the animation log would not
+                if (settings.order != CurveOrder::none && settings.reorderEvery > 0 && i % settings.reorderEvery == 0 && animationLog == nullptr){
+                    ScopedTimer reorderTimer("reorder");
+                    m.compact(true);
+                    reorder(m, settings.order);
+                }
+                profiler.structure("Quads", meshBytes(m));
+                profiler.structure("DefectField", field.bytes());
+                if (control != nullptr)
+                    control->remeshed(m, i);
+                break;
+            }
+        }
+
+        if (!hasRemeshed){
+            if (verbose && (control == nullptr || control->stopped == nullptr))
+                std::cout << "No more valid patch found." << std::endl;
+            break;
+        }
+    }
+
+    if (verbose && control != nullptr && control->stopped != nullptr)
+        std::cout << "Stopped after " << i << " iterations: " << control->stopped << std::endl;
+
+    // the facets the remeshes killed, and the vertices they left, see commitRemesh
+    if (std::find(m.conn->active.begin(), m.conn->active.end(), false) != m.conn->active.end()){
+        profiler.structure("Quads before compaction", meshBytes(m));
+        ScopedTimer timer("m.compact");
+        m.compact(true);
+    }
+
+    animationLog = previousLog;
+    if (log.out != nullptr){
+        ScopedTimer timer("animation flush");
+        if (!log.close())
+            std::cerr << "Error: can't write the animation in " << settings.animationPath << std::endl;
+        else if (verbose)
+            std::cout << "Animation of " << log.frames << " remeshes exported in " << settings.animationPath << std::endl;
+        profiler.count("animation writer waits", log.writer.waits);
+    }
+
+    return i;
+}
@@ -1,4 +1,8 @@
+#pragma once
+
 #include <ultimaille/all.h>
+#include <numeric>
+#include <vector>
 // https://www.mcs.anl.gov/~fathom/meshkit-docs/html/Mesh_8cpp_source.html (Jaal)
 
 inline int solve5equations(const int *segments, int *partSegments){
@@ -170,3 +174,112 @@ inline int solve4equations(int* segments, int* partSegments, int &a, int &b, int
 
     return false;
 }
+
+inline int flattenHexagon(const int* segments, int k, int* quadSegments){
+    // The sides of the quadrilateral a hexagon degenerates to when its corners k and k+3 are flattened, each one joining the sides on
+    // both of its sides. Returns the corner of the hexagon the first side starts from
+    int start = k == 0 ? 1 : 0;
+    int n = 0;
+    for (int i = start; i < start + 6; i++){
+        if (i % 3 == k)
+            quadSegments[n-1] += segments[i % 6];
+        else
+            quadSegments[n++] = segments[i % 6];
+    }
+    return start;
+}
+
+inline int solve6equations(const int *segments, int *partSegments){
+    //  Equations:
+    //      b0 -a2   = 0
+    //      b1 -a3   = 0
+    //      b2 -a4   = 0
+    //      b3 -a5   = 0
+    //      b4 -a0   = 0
+    //      b5 -a1   = 0
+    //      ai + bi  = si
+    // Unlike the 4 sided system, it is not singular: it splits into two independent cycles on the even and odd sides
+    //      a0 + a2 = s0,  a2 + a4 = s2,  a4 + a0 = s4
+    //      a1 + a3 = s1,  a3 + a5 = s3,  a5 + a1 = s5
+    // so each cycle needs an even perimeter to have an integer solution
+    // Returns 1 when every part is at least 1. A part ak of 0 leaves no room between the corner k and the centre: with the part of the
+    // opposite side a(k+3) at 0 too, the hexagon degenerates into a quadrilateral, its corners k and k+3 lying on its sides, and 2 is
+    // returned if the quadrilateral can be remeshed by solve4equations, see flattenHexagon. The other parts of 0 have no remesh
+
+    if ((segments[0] + segments[2] + segments[4]) % 2 != 0) return 0;
+    if ((segments[1] + segments[3] + segments[5]) % 2 != 0) return 0;
+
+    int x[6];
+    int zeros = 0;
+    for (int i = 0; i < 6; i++){
+        x[i] = (segments[i] - segments[(i+2)%6] + segments[(i+4)%6]) / 2;
+        if (x[i] < 0) return 0;
+        zeros += x[i] == 0;
+    }
+
+    if (zeros > 0){
+        int k = x[0] == 0 ? 0 : x[1] == 0 ? 1 : 2;
+        if (zeros != 2 || x[k] != 0 || x[k+3] != 0) return 0;
+        int quadSegments[4];
+        int quadParts[12];
+        int a, b, c, d;
+        flattenHexagon(segments, k, quadSegments);
+        if (!solve4equations(quadSegments, quadParts, a, b, c, d)) return 0;
+    }
+
+    for (int i = 0; i < 6; i++){
+        partSegments[2*i] = x[i];
+        partSegments[2*i+1] = x[(i+2)%6];
+    }
+
+    return zeros > 0 ? 2 : 1;
+}
+
+inline bool solvable3sides(int s0, int s1, int s2){
+    // Closed form of solve3equations: every part is half the perimeter minus the opposite side
+    int perimeter = s0 + s1 + s2;
+    if (perimeter % 2 != 0)
+        return false;
+    return perimeter/2 - s0 >= 1 && perimeter/2 - s1 >= 1 && perimeter/2 - s2 >= 1;
+}
+
+inline bool isSolvable(const std::vector<int>& segments){
+    // Cheap test telling if remeshingPatch can succeed with these side lengths, without building anything.
+    // Bunin's equations only have integer solutions when the perimeter is even
+
+    int n = segments.size();
+    int perimeter = std::accumulate(segments.begin(), segments.end(), 0);
+    if (perimeter % 2 != 0)
+        return false;
+
+    if (n == 3)
+        return solvable3sides(segments[0], segments[1], segments[2]);
+
+    if (n == 4){
+        if (segments[0] == segments[2] && segments[1] == segments[3])
+            return true;
+
+        // same triangle insertions as solve4equations
+        int a = std::max(segments[0], segments[2]);
+        int c = std::min(segments[0], segments[2]);
+        int b = std::min(segments[1], segments[3]);
+        int d = std::max(segments[1], segments[3]);
+        return solvable3sides(d-b, c, a) || solvable3sides(a-c, b, d);
+    }
+
+    if (n == 5){
+        // Closed form of solve5equations: every part is half the perimeter minus two consecutive sides
+        for (int i = 0; i < 5; i++)
+            if (perimeter/2 - segments[i] - segments[(i+1)%5] < 1)
+                return false;
+        return true;
+    }
+
+    if (n == 6){
+        // solve6equations is a closed form already, which tries the quadrilateral of a degenerate hexagon as well
+        int partSegments[12];
+        return solve6equations(segments.data(), partSegments) != 0;
+    }
+
+    return false;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <ultimaille/all.h>
+
+using namespace UM;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Packed attributes
+//
+// Facet and corner attributes of a few bits, packed in 64 bit words. The state of a facet in the patch fits in 2 bits and a hard edge
+// in 1, where the int attributes took 32, so the fill of the patch at each defect and the scans over all the facets or halfedges read
+// 16 to 32 times less memory. They are bound to the mesh like the attributes of ultimaille, so they follow its facets when they are
+// created or compacted. The int attributes are only used at the interface of the library, see loadAttribute and storeAttribute
+
+template <int BITS>
+struct PackedContainer : GenericAttributeContainer {
+    static_assert(64 % BITS == 0, "a value can't be split between two words");
+    static constexpr int PER_WORD = 64 / BITS;
+    static constexpr uint64_t MASK = (uint64_t(1) << BITS) - 1;
+
+    std::vector<uint64_t> words; // the bits after the n values are kept at 0, so the words can be scanned as a whole
+    int n = 0;
+    int def;
+
+    PackedContainer(int n, int def) : def(def) {
+        resize(n);
+    }
+
+    int get(int i) const {
+        return (words[unsigned(i) / PER_WORD] >> (BITS * (unsigned(i) % PER_WORD))) & MASK;
+    }
+
+    void set(int i, int value){
+        uint64_t& word = words[unsigned(i) / PER_WORD];
+        int shift = BITS * (unsigned(i) % PER_WORD);
+        word = (word & ~(MASK << shift)) | ((uint64_t(value) & MASK) << shift);
+    }
+
+    void fill(int value){
+        uint64_t pattern = 0;
+        for (int i = 0; i < PER_WORD; i++)
+            pattern |= (uint64_t(value) & MASK) << (BITS * i);
+        std::fill(words.begin(), words.end(), pattern);
+        clearTail();
+    }
+
+    void clearTail(){
+        if (n % PER_WORD != 0)
+            words.back() &= (uint64_t(1) << (BITS * (n % PER_WORD))) - 1;
+    }
+
+    void resize(const int size) override {
+        int old = std::min(n, size);
+        words.resize((size + PER_WORD - 1) / PER_WORD, 0);
+        n = size;
+        clearTail();
+        for (int i = old; i < size; i++)
+            set(i, def);
+    }
+
+    void compress(const std::vector<int>& old2new) override {
+        // as the containers of ultimaille: the elements kept move down to their new index, in order
+        int count = 0;
+        for (int i = 0; i < (int)old2new.size(); i++){
+            if (old2new[i] < 0)
+                continue;
+            set(old2new[i], get(i));
+            count++;
+        }
+        resize(count);
+    }
+};
+
+template <int BITS>
+struct PackedAttribute {
+    std::shared_ptr<PackedContainer<BITS>> ptr;
+
+    struct Reference {
+        PackedContainer<BITS>& container;
+        int i;
+
+        operator int() const {
+            return container.get(i);
+        }
+
+        Reference& operator=(int value){
+            container.set(i, value);
+            return *this;
+        }
+    };
+
+    int operator[](const int i) const {
+        return ptr->get(i);
+    }
+
+    Reference operator[](const int i){
+        return {*ptr, i};
+    }
+
+    void fill(int value){
+        ptr->fill(value);
+    }
+
+    int size() const {
+        return ptr->n;
+    }
+
+    long bytes() const {
+        return ptr->words.size() * sizeof(uint64_t);
+    }
+};
+
+template <int BITS>
+struct PackedFacetAttribute : PackedAttribute<BITS> {
+    PackedFacetAttribute(Surface& m, int def = 0){
+        this->ptr = std::make_shared<PackedContainer<BITS>>(m.nfacets(), def);
+        m.attr_facets.push_back(this->ptr);
+    }
+};
+
+template <int BITS>
+struct PackedCornerAttribute : PackedAttribute<BITS> {
+    PackedCornerAttribute(Surface& m, int def = 0){
+        this->ptr = std::make_shared<PackedContainer<BITS>>(m.ncorners(), def);
+        m.attr_corners.push_back(this->ptr);
+    }
+};
+
+using FacetStates = PackedFacetAttribute<2>; // the facets of the patch, 0 outside, 1 to 3 inside, see patchFinding.h
+using FacetFlags = PackedFacetAttribute<1>;
+using CornerFlags = PackedCornerAttribute<1>;  // the hard edges, on the corners their halfedges start from
+
+template <int BITS>
+inline void loadAttribute(PackedAttribute<BITS>& packed, GenericAttribute<int>& attribute){
+    // the values that don't fit in the bits are cut, so an int attribute of flags must only hold 0 and 1
+    for (int i = 0; i < packed.size(); i++)
+        packed[i] = attribute.ptr->data[i];
+}
+
+template <int BITS>
+inline void storeAttribute(const PackedAttribute<BITS>& packed, GenericAttribute<int>& attribute){
+    for (int i = 0; i < packed.size(); i++)
+        attribute.ptr->data[i] = packed[i];
+}
+
+template <int BITS, class F>
+inline bool forEachNonZero(const PackedAttribute<BITS>& attribute, F f){
+    // Calls f(i, value) for the values that aren't 0, in order, until it returns false. The words at 0 are skipped at once, so a scan
+    // for the few facets of a patch reads 32 of them at a time. False if stopped by f
+    using Container = PackedContainer<BITS>;
+    const std::vector<uint64_t>& words = attribute.ptr->words;
+    for (int w = 0; w < (int)words.size(); w++)
+        for (uint64_t word = words[w]; word != 0;){
+            int slot = std::countr_zero(word) / BITS;
+            if (!f(w * Container::PER_WORD + slot, int((word >> (BITS * slot)) & Container::MASK)))
+                return false;
+            word &= ~(Container::MASK << (BITS * slot));
+        }
+    return true;
+}
+
+template <int BITS>
+inline void permute(PackedContainer<BITS>& container, const std::vector<int>& order, int stride){
+    // value i becomes value order[i], by blocks of stride values, as permute in reordering.h
+    PackedContainer<BITS> permuted(container.n, 0);
+    for (int i = 0; i < (int)order.size(); i++)
+        for (int j = 0; j < stride; j++)
+            permuted.set(stride*i + j, container.get(stride*order[i] + j));
+    container.words.swap(permuted.words);
+}
@@ -1,6 +1,17 @@
+#pragma once
+
 #include "ultimaille/attributes.h"
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstdint>
 #include <list>
+#include <numbers>
+#include <queue>
+#include <vector>
 #include <ultimaille/all.h>
+#include "packedAttributes.h"
+#include "matrixEquations.h"
 
 using namespace UM;
 using Halfedge = typename Surface::Halfedge;
@@ -9,17 +20,33 @@ using Vertex = typename Surface::Vertex;
 
 const int MAX_VALENCE = 8;
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////
-// patch finding
+// Why the last patch construction or expansion failed, kept for the telemetry of the patch attempts
+inline thread_local const char* patchFailure = "";
+
+// messages on the progress of the remeshing, per thread so that concurrent runs can be silenced separately
+inline thread_local bool verbose = true;
+
+inline int failPatch(const char* reason){
+    patchFailure = reason;
+    return -1;
+}
 
 inline int getValence(Vertex v){
     int valence = 0;
     Halfedge he = v.halfedge();
     Halfedge startHe = he;
 
+    // a vertex left without facets by a remesh, until the mesh is compacted, see commitRemesh
+    if (he == -1)
+        return 4;
+
     for (int i = 0; i < MAX_VALENCE; i++){
         valence++;
 
+        // The vertices on a border, of an open mesh or around a selected region, are left as they are, like the regular ones. The walks
+        // of the patches stop at the border too, so it is kept as it is
+        if (he.opposite() == -1)
+            return 4;
         he = he.opposite().next();
         if (he == startHe)
             return valence;
@@ -28,77 +55,42 @@ inline int getValence(Vertex v){
     return 4;
 }
 
-inline bool isNewDefect(Vertex v, std::vector<int>& defects) {
-    if (getValence(v) != 4 && 
-        std::find(defects.begin(), defects.end(), v) == defects.end()) {
-        defects.push_back(v);
-        return true;
-    }
-    return false;
-}
+inline void markHardEdges(Quads& m, CornerFlags& hardEdges){
+    for (Halfedge he: m.iter_halfedges()){
 
-inline void patchRotationRightToEdge(std::list<int>& patch, std::list<int>& patchConvexity){
-    for (int i=0; i<int(patchConvexity.size()); i++){
-        if (patchConvexity.front() < 1){
-            patch.splice(patch.begin(), patch, std::prev(patch.end()));
-            patchConvexity.splice(patchConvexity.begin(), patchConvexity, std::prev(patchConvexity.end()));
-        } else {
-            break;
+        if (he.opposite() == -1 || hardEdges[he] == 1){
+            hardEdges[he] = 1;
+            continue;
         }
-    }
-}
-
-inline int countFacetsInsidePatch(FacetAttribute<int>& fa, int nfacets){
-    int nbFacetInsidePatch = 0;
-    for (int f = 0; f < nfacets; f++){
-        if (fa[f] > 1)
-            nbFacetInsidePatch++;
-    }
-    return nbFacetInsidePatch;
-}
-
-inline int checkTopologicalDisk(FacetAttribute<int>& fa, Quads& m, std::list<int>& patch){
-    // Veryfing that we have a topological disk, i.e. all the facets surrounding the inside of the patch are in the patch
-
-    for (int i : patch)
-        fa[Halfedge(m, i).facet()] = 3;
-
-    for (int i = 0; i < m.nfacets(); i++)
-        if (fa[i] > 0 && fa[i] < 3) // facet in the patch but not on the outline
-            for (Halfedge he : Facet(m, i).iter_halfedges())
-                if (fa[he.opposite().facet()] < 1)
-                    return -1;
-
-    for (int i : patch){
-        if (fa[Halfedge(m, i).facet()] == 3)
-            fa[Halfedge(m, i).facet()] = 2;
-    }
-
-    return 1;
-}
-
-inline int postPatch(FacetAttribute<int>& fa, Quads& m, std::list<int>& patch, std::list<int>& patchConvexity, CornerAttribute<int>& ca){
-    if (checkTopologicalDisk(fa, m, patch) == -1)
-        return -1;
-
-    // check if no hard edge has been violated    
-    for (Halfedge he : m.iter_halfedges()){
-        if (ca[he] == 1 && fa[he.facet()] > 1 && fa[he.opposite().facet()] > 1){
-            return -1;
+        
+        vec3 n1 = he.facet().geom<Quad3>().normal();
+        vec3 n2 = he.opposite().facet().geom<Quad3>().normal();
+        n1.normalize();
+        n2.normalize();
+        double ndot = (n1.x*n2.x + n1.y*n2.y + n1.z*n2.z); 
+        double angle = atan2(cross(n1,n2).norm(), ndot);
+
+        if (angle >= std::numbers::pi/4){
+            hardEdges[he] = 1;
+            hardEdges[he.opposite()] = 1;
         }
     }
+}
 
-    patchRotationRightToEdge(patch, patchConvexity);
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// breadth-first search seeding
 
-    int nbEdge = 0;
-    for (int convexity : patchConvexity){
-        if (convexity >= 1)
-            nbEdge++;
+inline bool isNewDefect(Vertex v, std::vector<int>& defects) {
+    if (getValence(v) != 4 && 
+        std::find(defects.begin(), defects.end(), v) == defects.end()) {
+        defects.push_back(v);
+        return true;
     }
-    return nbEdge;
+    return false;
 }
 
-inline int bfs(int startFacet, FacetAttribute<int>& fa, Quads& m, CornerAttribute<int>& ca){
+inline int bfs(int startFacet, FacetStates& fa, Quads& m, CornerFlags& ca){
+    // Marks the facets met by a breadth-first search from startFacet until it has seen 3 defects, as a starting patch
     std::queue<int> facetQueue;
     int defectCount = 0;
     std::vector<int> defectVertices;
@@ -152,15 +144,16 @@ inline int bfs(int startFacet, FacetAttribute<int>& fa, Quads& m, CornerAttribut
             }
         }
     }
-
     // find a halfedge in the border of the patch, inside the patch
     int max_iter = 500;
     while(fa[facetHalfedge.facet()] >= 1 && max_iter > 0){
+        if (facetHalfedge.next().next().opposite() == -1)
+            return failPatch("mesh border");
         facetHalfedge = facetHalfedge.next().next().opposite();
         max_iter--;
     }
     if (max_iter == 0) // should happen if the patch covers the whole mesh
-        return -1;
+        return failPatch("patch covers the mesh");
 
     facetHalfedge = facetHalfedge.opposite();
 
@@ -170,47 +163,654 @@ inline int bfs(int startFacet, FacetAttribute<int>& fa, Quads& m, CornerAttribut
     return facetHalfedge;
 }
 
-inline int getPatch(Halfedge boundaryHe, FacetAttribute<int>& fa, std::list<int>& patch, std::list<int>& patchConvexity){
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// distance field from the defects
+
+// How the first patch around a defect is found: the facets met by a breadth-first search until it has seen 3 defects, or the smallest
+// ball reaching the 2 defects closest to it in the distance field below
+enum class PatchSeeding { bfs, field };
+
+struct DefectField {
+    // For every facet, the number of facets to cross to reach a facet touching a defect, and the label of that defect.
+    // The labels are stored on the vertices, so they follow the vertices when the mesh is compacted after a remesh.
+    // Hard edges are never crossed, like in the patch construction.
+    // With the bfs seeding, the field is neither built nor updated, and only seeds the patches with bfs()
+
+    static constexpr int UNREACHED = INT_MAX; // no defect can be reached from the facet. New facets are at -1 until update()
+
+    Quads& m;
+    CornerFlags& ca;
+    PatchSeeding seeding;
+    FacetAttribute<int> distance;
+    FacetAttribute<int> nearest;
+    PointAttribute<int> label;
+    int nbLabels = 0;
+
+    DefectField(Quads& m, CornerFlags& ca, PatchSeeding seeding = PatchSeeding::field) : m(m), ca(ca), seeding(seeding), distance(m, -1), nearest(m, -1), label(m.points, -1) {
+        distance.fill(UNREACHED);
+        if (seeding == PatchSeeding::bfs)
+            return;
+
+        std::vector<int> sources;
+        for (Vertex v : m.iter_vertices())
+            if (getValence(v) != 4)
+                addSource(v, sources);
+
+        propagate(sources);
+    }
+
+    void facetsAround(int f, std::vector<int>& around){
+        // facets sharing a vertex with f, without going across hard edges, like the growth of the patch.
+        // The facets sharing an edge with f are met from both its vertices, but only listed once: the walks over the field rely on it
+        around.clear();
+        for (Halfedge he : Facet(m, f).iter_halfedges()){
+            for (int i = 0; i < MAX_VALENCE; i++){
+                if (ca[he] == 1 || he.opposite() == -1)
+                    break;
+                he = he.opposite().next();
+                if (he.facet() == f)
+                    break;
+                if (std::find(around.begin(), around.end(), he.facet()) == around.end())
+                    around.push_back(he.facet());
+            }
+        }
+    }
+
+    void addSource(Vertex v, std::vector<int>& sources){
+        if (label[v] == -1)
+            label[v] = nbLabels++;
+
+        Halfedge he = v.halfedge();
+        for (int i = 0; i < MAX_VALENCE; i++){
+            if (distance[he.facet()] != 0){
+                distance[he.facet()] = 0;
+                nearest[he.facet()] = label[v];
+                sources.push_back(he.facet());
+            }
+            if (he.opposite() == -1)
+                break;
+            he = he.opposite().next();
+            if (he == v.halfedge())
+                break;
+        }
+    }
+
+    void propagate(std::vector<int>& sources){
+        // Dijkstra from the sources, which may start at different distances after an update
+        std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<>> queue;
+        for (int f : sources)
+            queue.push({distance[f], f});
+
+        std::vector<int> around;
+        while (!queue.empty()){
+            auto [d, f] = queue.top();
+            queue.pop();
+            if (d != distance[f])
+                continue;
+
+            facetsAround(f, around);
+            for (int g : around){
+                if (distance[g] == -1 || distance[g] > d + 1){
+                    distance[g] = d + 1;
+                    nearest[g] = nearest[f];
+                    queue.push({d + 1, g});
+                }
+            }
+        }
+    }
+
+    int parent(int f){
+        // neighbouring facet the distance of f comes from
+        std::vector<int> around;
+        facetsAround(f, around);
+        for (int g : around)
+            if (distance[g] == distance[f] - 1 && nearest[g] == nearest[f])
+                return g;
+        return -1;
+    }
+
+    int sourceVertex(int f){
+        // walk down the field to the defect f is closest to, -1 if the path has been broken by a remesh
+        int l = nearest[f];
+        while (distance[f] > 0){
+            f = parent(f);
+            if (f == -1)
+                return -1;
+        }
+        if (distance[f] != 0)
+            return -1;
+
+        for (int i = 0; i < 4; i++)
+            if (label[m.vert(f, i)] == l)
+                return m.vert(f, i);
+        return -1;
+    }
+
+    long bytes(){
+        return (distance.ptr->data.size() + nearest.ptr->data.size() + label.ptr->data.size()) * sizeof(int);
+    }
+
+    void update(){
+        // Local update after a remesh: the new facets have been appended at the end of the mesh with a distance of -1.
+        // Facets whose distance went through the old patch, or came from a defect that disappeared, are recomputed too.
+        if (seeding == PatchSeeding::bfs)
+            return;
+
+        std::vector<int> invalid;
+        for (int f = m.nfacets() - 1; f >= 0 && distance[f] == -1; f--)
+            invalid.push_back(f);
+
+        std::vector<int> newVertices;
+        for (int f : invalid)
+            for (int i = 0; i < 4; i++)
+                newVertices.push_back(m.vert(f, i));
+
+        std::vector<int> toCheck;
+        for (int v : newVertices){
+            if (getValence(Vertex(m, v)) == 4)
+                label[v] = -1;
+
+            Halfedge he = Vertex(m, v).halfedge();
+            for (int i = 0; i < MAX_VALENCE; i++){
+                toCheck.push_back(he.facet());
+                if (he.opposite() == -1)
+                    break;
+                he = he.opposite().next();
+                if (he == Vertex(m, v).halfedge())
+                    break;
+            }
+        }
+        std::vector<int> around;
+        for (int f : invalid){
+            facetsAround(f, around);
+            toCheck.insert(toCheck.end(), around.begin(), around.end());
+        }
+
+        while (!toCheck.empty()){
+            int f = toCheck.back();
+            toCheck.pop_back();
+            if (distance[f] == -1 || distance[f] == UNREACHED || sourceVertex(f) != -1)
+                continue;
+
+            distance[f] = -1;
+            invalid.push_back(f);
+            facetsAround(f, around);
+            toCheck.insert(toCheck.end(), around.begin(), around.end());
+        }
+
+        std::vector<int> sources;
+        for (int v : newVertices)
+            if (getValence(Vertex(m, v)) != 4)
+                addSource(Vertex(m, v), sources);
+
+        for (int f : invalid){
+            // a facet touching several defects may have lost only the one it was closest to
+            for (int i = 0; i < 4; i++){
+                int u = m.vert(f, i);
+                if (label[u] != -1 && distance[f] != 0){
+                    distance[f] = 0;
+                    nearest[f] = label[u];
+                    sources.push_back(f);
+                }
+            }
+
+            facetsAround(f, around);
+            for (int g : around)
+                if (distance[g] != -1 && distance[g] != UNREACHED)
+                    sources.push_back(g);
+        }
+
+        propagate(sources);
+
+        for (int f : invalid)
+            if (distance[f] == -1)
+                distance[f] = UNREACHED;
+    }
+
+    int seedPatch(Vertex v, FacetStates& fa){
+        // Marks the smallest ball around v reaching the two defects closest to it, as a starting patch.
+        // The defects next to v are read on the border of its cell in the field, so isolated defects are rejected without exploring the mesh.
+        if (seeding == PatchSeeding::bfs)
+            return bfs(v.halfedge().facet(), fa, m, ca);
+
+        int l = label[v];
+        if (l == -1)
+            return failPatch("isolated defect");
+
+        std::vector<std::pair<int, int>> closest; // estimated distance, facet on the way to the defect
+        std::vector<int> cell;
+        Halfedge he = v.halfedge();
+        for (int i = 0; i < MAX_VALENCE; i++){
+            int f = he.facet();
+            if (nearest[f] == l)
+                cell.push_back(f);
+
+            // other defects sharing a facet with v
+            for (int j = 0; j < 4; j++){
+                int u = m.vert(f, j);
+                if (u != v && label[u] != -1 && label[u] != l)
+                    closest.push_back({0, f});
+            }
+
+            if (he.opposite() == -1)
+                break;
+            he = he.opposite().next();
+            if (he == v.halfedge())
+                break;
+        }
+
+        // the cell is a tree along the field, so each facet is reached once from its parent
+        std::vector<int> around;
+        for (int c = 0; c < int(cell.size()); c++){
+            int f = cell[c];
+            facetsAround(f, around);
+            for (int g : around){
+                if (distance[g] == UNREACHED)
+                    continue;
+                if (nearest[g] != l)
+                    closest.push_back({distance[f] + 1 + distance[g], g});
+                else if (distance[g] == distance[f] + 1 && parent(g) == f)
+                    cell.push_back(g);
+            }
+        }
+
+        // keep the closest facet of each neighbouring defect
+        std::sort(closest.begin(), closest.end());
+        std::vector<int> defects;
+        int radius = 0;
+        for (auto [d, f] : closest){
+            int u = -1;
+            if (d == 0){
+                for (int j = 0; j < 4 && u == -1; j++)
+                    if (m.vert(f, j) != v && label[m.vert(f, j)] != -1 && label[m.vert(f, j)] != l)
+                        u = m.vert(f, j);
+            } else {
+                u = sourceVertex(f);
+            }
+            if (u == -1 || std::find(defects.begin(), defects.end(), u) != defects.end())
+                continue;
+
+            defects.push_back(u);
+            radius = d;
+            if (defects.size() == 2)
+                break;
+        }
+        if (defects.size() < 2)
+            return failPatch("isolated defect");
+
+        // ball of the facets at most radius facets away from v
+        std::vector<std::pair<int, int>> ball; // facet, depth
+        he = v.halfedge();
+        for (int i = 0; i < MAX_VALENCE; i++){
+            if (fa[he.facet()] == 0){
+                fa[he.facet()] = 1;
+                ball.push_back({he.facet(), 0});
+            }
+            if (he.opposite() == -1)
+                break;
+            he = he.opposite().next();
+            if (he == v.halfedge())
+                break;
+        }
+        for (int b = 0; b < int(ball.size()); b++){
+            auto [f, depth] = ball[b];
+            if (depth == radius)
+                continue;
+            facetsAround(f, around);
+            for (int g : around){
+                if (fa[g] == 0){
+                    fa[g] = 1;
+                    ball.push_back({g, depth + 1});
+                }
+            }
+        }
+
+        // marking the facets surrounding the defects, so that they end up inside the patch
+        for (int u : defects){
+            he = Vertex(m, u).halfedge();
+            for (int i = 0; i < MAX_VALENCE; i++){
+                fa[he.facet()] = 1;
+                if (ca[he] == 1 || he.opposite() == -1)
+                    break;
+                he = he.opposite().next();
+                if (he == Vertex(m, u).halfedge())
+                    break;
+            }
+        }
+
+        // find a halfedge in the border of the patch, inside the patch, starting from the outermost facet of the ball
+        Halfedge facetHalfedge = Facet(m, ball.back().first).halfedge();
+        int max_iter = 500;
+        while(fa[facetHalfedge.facet()] >= 1 && max_iter > 0){
+            if (facetHalfedge.next().next().opposite() == -1)
+                return failPatch("mesh border");
+            facetHalfedge = facetHalfedge.next().next().opposite();
+            max_iter--;
+        }
+        if (max_iter == 0) // should happen if the patch covers the whole mesh
+            return failPatch("patch covers the mesh");
+
+        facetHalfedge = facetHalfedge.opposite();
+
+        assert(fa[facetHalfedge.facet()]>0);
+        assert(fa[facetHalfedge.opposite().facet()]<1);
+
+        return facetHalfedge;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// patch finding
+
+inline void patchRotationRightToEdge(std::list<int>& patch, std::list<int>& patchConvexity){
+    for (int i=0; i<int(patchConvexity.size()); i++){
+        if (patchConvexity.front() < 1){
+            patch.splice(patch.begin(), patch, std::prev(patch.end()));
+            patchConvexity.splice(patchConvexity.begin(), patchConvexity, std::prev(patchConvexity.end()));
+        } else {
+            break;
+        }
+    }
+}
+
+inline int countFacetsInsidePatch(FacetStates& fa){
+    // the facets inside the patch are at 2 or 3, the ones with the high bit of their state set, counted a word at a time
+    int nbFacetInsidePatch = 0;
+    for (uint64_t word : fa.ptr->words)
+        nbFacetInsidePatch += std::popcount(word & 0xAAAAAAAAAAAAAAAAull);
+    return nbFacetInsidePatch;
+}
+
+inline int checkTopologicalDisk(FacetStates& fa, Quads& m, std::list<int>& patch){
+    // Veryfing that we have a topological disk, i.e. all the facets surrounding the inside of the patch are in the patch
+
+    for (int i : patch)
+        fa[Halfedge(m, i).facet()] = 3;
+
+    bool disk = forEachNonZero(fa, [&](int i, int state){
+        if (state < 3) // facet in the patch but not on the outline
+            for (Halfedge he : Facet(m, i).iter_halfedges())
+                if (he.opposite() == -1 || fa[he.opposite().facet()] < 1)
+                    return false;
+        return true;
+    });
+    if (!disk)
+        return failPatch("not a topological disk");
+
+    for (int i : patch){
+        if (fa[Halfedge(m, i).facet()] == 3)
+            fa[Halfedge(m, i).facet()] = 2;
+    }
+
+    return 1;
+}
+
+inline int checkHardEdges(FacetStates& fa, Quads& m, CornerFlags& ca){
+    // check if no hard edge has been violated
+    // A violation can't be undone by expanding the patch, so the patch is dropped as soon as one shows up
+    bool violated = !forEachNonZero(fa, [&](int f, int state){
+        if (state > 1)
+            for (Halfedge he : Facet(m, f).iter_halfedges())
+                if (ca[he] == 1 && he.opposite() != -1 && fa[he.opposite().facet()] > 1)
+                    return false;
+        return true;
+    });
+    if (violated)
+        return failPatch("hard edge violated");
+
+    return 1;
+}
+
+inline void segmentConstruction(int outlineSize, std::vector<int>& segments){
+    // getPatch leaves in segments the positions of the corners along the outline, turned here into the number of edges of each side,
+    // starting from the corner patchRotationRightToEdge brings to the front: the first corner if the outline starts on one, the last otherwise
+    if (segments.empty()){
+        segments.push_back(outlineSize);
+        return;
+    }
+    int first = segments.front();
+    int last = segments.back();
+    int wrapping = outlineSize - last + first;
+    if (first == 0){
+        for (int i = 0; i+1 < int(segments.size()); i++)
+            segments[i] = segments[i+1] - segments[i];
+        segments.back() = wrapping;
+    } else {
+        for (int i = int(segments.size())-1; i > 0; i--)
+            segments[i] = segments[i] - segments[i-1];
+        segments.front() = wrapping;
+    }
+}
+
+inline int postPatch(FacetStates& fa, Quads& m, std::list<int>& patch, std::list<int>& patchConvexity, std::vector<int>& segments, CornerFlags& ca){
+    // Returns the number of sides of the patch, 0 if Bunin's equations can't solve them and the patch has to be expanded. The disk check
+    // can't wait for a solvable shape: a patch expanded past it can wrap around a handle until the check no longer sees it
+    if (checkTopologicalDisk(fa, m, patch) == -1)
+        return -1;
+
+    // after the disk check, which brings the outline to 2
+    if (checkHardEdges(fa, m, ca) == -1)
+        return -1;
+
+    patchRotationRightToEdge(patch, patchConvexity);
+    if (!isSolvable(segments))
+        return 0;
+
+    return segments.size();
+}
+
+inline int checkFrozen(FacetStates& fa, FacetFlags& frozen){
+    // the frozen facets, the ring around a selection, can't be replaced. Checked once the patch can be remeshed
+    if (!forEachNonZero(fa, [&](int f, int){ return frozen[f] == 0; }))
+        return failPatch("frozen facet");
+
+    return 1;
+}
+
+inline int getPatch(Halfedge boundaryHe, FacetStates& fa, std::list<int>& patch, std::list<int>& patchConvexity, std::vector<int>& segments){
     // We want a list of all the halfedge on the boundary of the patch (information is in fa)
     // boundaryHe is a halfedge on the patch. We start from here and do a rotation outward of the patch to find the next halfedge, and so on until coming back to the start
+    // The corners are recorded on the way, giving the side lengths without another pass over the outline
 
     assert(boundaryHe >= 0);
     patch.clear();
     patchConvexity.clear();
+    segments.clear();
 
     patch.push_back(boundaryHe);
     Halfedge startHe = boundaryHe;
+    int outlineSize = 0;
  
     do{
         if (boundaryHe.opposite() == -1)
-            return -1;
+            return failPatch("mesh border");
         boundaryHe = boundaryHe.opposite();
-        for (int i=0; i<MAX_VALENCE; i++){
+        // turning around the vertex until the patch is met again, which can take more than MAX_VALENCE facets on a vertex of the input.
+        // Stopping before would leave the walk on a halfedge off the outline, never to come back to the start
+        Halfedge turnStart = boundaryHe;
+        bool found = false;
+        for (int i=0; !found; i++){
             if (boundaryHe.prev().opposite() == -1)
-                return -1;
+                return failPatch("mesh border");
             boundaryHe = boundaryHe.prev().opposite();
             //boundaryHe.iter_sector_halfedges()
             if (fa[boundaryHe.facet()] >= 1){
                 patch.push_back(boundaryHe);
                 patchConvexity.push_back(i-1);
-                break;
-            }
+                if (i-1 >= 1)
+                    segments.push_back(outlineSize);
+                outlineSize++;
+                found = true;
+            } else if (boundaryHe == turnStart)
+                return failPatch("outline lost");
         }
     } while (boundaryHe != startHe);
 
     patch.pop_front();
+    segmentConstruction(outlineSize, segments);
     return 1;
 }
 
-inline int updateBoundaryHe(int& boundaryHe, Halfedge& he , FacetAttribute<int>& fa, Quads& m){
+template<class F> void forEachIncoming(Vertex v, F f){
+    // the halfedges ending at v, turning the other way from v.halfedge() too when v is on a border
+    Halfedge start = v.halfedge();
+    Halfedge he = start;
+    do {
+        f(he.prev());
+        if (he.prev().opposite() == -1)
+            break;
+        he = he.prev().opposite();
+    } while (he != start);
+    if (he == start && he.prev().opposite() != -1)
+        return;
+    he = start;
+    while (he.opposite() != -1){
+        he = he.opposite().next();
+        f(he.prev());
+    }
+}
+
+struct PatchOutline {
+    // The outline of the patch kept from one expansion to the next, as each of its halfedges with the next one and the convexity at the
+    // vertex between them. An expansion only turns again around the vertices of the facets it adds, the outline is then walked without
+    // turning, getPatch being left as the walk from scratch it is checked against in debug builds. The steps are indexed by the halfedges,
+    // kept from one patch to the next and cleared through the ones set
+    struct Step {
+        int next = OFF;
+        int convexity = 0;
+        const char* failure = nullptr;
+    };
+    static const int OFF = -2;  // next of a halfedge off the outline
+
+    Quads& m;
+    std::vector<Step> steps;
+    std::vector<int> set;
+    std::vector<int> stamps;    // the last addition each vertex was turned around for
+    int additions = 0;
+
+    PatchOutline(Quads& m) : m(m) {}
+
+    bool onOutline(Halfedge he, FacetStates& fa){
+        return fa[he.facet()] >= 1 && he.opposite() != -1 && fa[he.opposite().facet()] < 1;
+    }
+
+    void turn(Halfedge he, FacetStates& fa){
+        // the same turn as getPatch, around the vertex he ends at
+        Step& step = steps[he];
+        if (step.next == OFF)
+            set.push_back(he);
+        step = {-1, 0, nullptr};
+        he = he.opposite();
+        Halfedge turnStart = he;
+        for (int i=0; ; i++){
+            if (he.prev().opposite() == -1){
+                step.failure = "mesh border";
+                return;
+            }
+            he = he.prev().opposite();
+            if (fa[he.facet()] >= 1){
+                step.next = he;
+                step.convexity = i-1;
+                return;
+            }
+            if (he == turnStart){
+                step.failure = "outline lost";
+                return;
+            }
+        }
+    }
+
+    void build(FacetStates& fa){
+        for (int he : set)
+            steps[he] = Step();
+        set.clear();
+        steps.resize(m.ncorners());
+        stamps.resize(m.nverts(), -1);
+        forEachNonZero(fa, [&](int f, int){
+            for (Halfedge he : Facet(m, f).iter_halfedges())
+                if (onOutline(he, fa))
+                    turn(he, fa);
+            return true;
+        });
+    }
+
+    void add(const std::vector<int>& facets, FacetStates& fa){
+        // the facets just put in the patch only change the steps ending at one of their vertices. The halfedges of the facets outside of
+        // the patch were never on its outline
+        additions++;
+        for (int f : facets)
+            for (Halfedge fhe : Facet(m, f).iter_halfedges()){
+                int v = fhe.from();
+                if (stamps[v] == additions)
+                    continue;
+                stamps[v] = additions;
+                forEachIncoming(Vertex(m, v), [&](Halfedge he){
+                    if (fa[he.facet()] < 1)
+                        return;
+                    if (onOutline(he, fa))
+                        turn(he, fa);
+                    else
+                        steps[he].next = OFF;
+                });
+            }
+    }
+
+    int walk(Halfedge start, FacetStates& fa, std::list<int>& patch, std::list<int>& patchConvexity, std::vector<int>& segments){
+        // the lists of getPatch, from the halfedge start on
+        int walked = walkSteps(start, fa, patch, patchConvexity, segments);
+#ifndef NDEBUG
+        const char* failure = patchFailure;
+        std::list<int> fullPatch, fullConvexity;
+        std::vector<int> fullSegments;
+        assert(getPatch(start, fa, fullPatch, fullConvexity, fullSegments) == walked);
+        assert(walked == -1 || (patch == fullPatch && patchConvexity == fullConvexity && segments == fullSegments));
+        patchFailure = failure;
+#endif
+        return walked;
+    }
+
+    int walkSteps(Halfedge start, FacetStates& fa, std::list<int>& patch, std::list<int>& patchConvexity, std::vector<int>& segments){
+        // a start off the outline is left to the full walk
+        if (steps[start].next == OFF)
+            return getPatch(start, fa, patch, patchConvexity, segments);
+
+        patch.clear();
+        patchConvexity.clear();
+        segments.clear();
+
+        patch.push_back(start);
+        int he = start;
+        int outlineSize = 0;
+        do {
+            const Step& step = steps[he];
+            assert(step.next != OFF);
+            if (step.failure != nullptr)
+                return failPatch(step.failure);
+            patch.push_back(step.next);
+            patchConvexity.push_back(step.convexity);
+            if (step.convexity >= 1)
+                segments.push_back(outlineSize);
+            outlineSize++;
+            he = step.next;
+        } while (he != start);
+
+        patch.pop_front();
+        segmentConstruction(outlineSize, segments);
+        return 1;
+    }
+};
+
+inline int updateBoundaryHe(int& boundaryHe, Halfedge& he , FacetStates& fa, Quads& m){
     // Makes sure we have a halfedge on the boundary of the patch
 
+    // a halfedge on the border of the mesh isn't on the boundary of the patch, there is nothing on the other side to grow to
+    auto outside = [&](Halfedge h){ return h.opposite() != -1 && fa[h.opposite().facet()] < 1; };
     he = he.next();
-    if (fa[he.next().opposite().facet()] < 1){
+    if (outside(he.next())){
         boundaryHe = he.next();
-    } else if (fa[he.opposite().facet()] < 1){
+    } else if (outside(he)){
         boundaryHe = he;
-    } else if (fa[he.next().next().opposite().facet()] < 1){
+    } else if (outside(he.next().next())){
         boundaryHe = he.next().next();
     } else {
         // We failed to find a nearby boundary, so we go through the whole thing to find it now
@@ -224,7 +824,7 @@ inline int updateBoundaryHe(int& boundaryHe, Halfedge& he , FacetAttribute<int>&
         //                return 1;
         //            }
 
-        return -1;
+        return failPatch("boundary lost");
     }
 
     assert(fa[Halfedge(m, boundaryHe).facet()]>0);
@@ -232,13 +832,15 @@ inline int updateBoundaryHe(int& boundaryHe, Halfedge& he , FacetAttribute<int>&
     return 1;
 } 
 
-inline int makePatchConcave(int& boundaryHe, std::list<int>& patch, std::list<int>& patchConvexity, FacetAttribute<int>& fa, Quads& m, CornerAttribute<int>& ca){
+inline int makePatchConcave(int& boundaryHe, std::list<int>& patch, std::list<int>& patchConvexity, std::vector<int>& segments, FacetStates& fa, Quads& m, CornerFlags& ca, PatchOutline& outline){
 
     int max_iter = 100;
     bool hasConcave = true;
+    std::vector<int> added;
     while (hasConcave && max_iter > 0){
 
         hasConcave = false;
+        added.clear();
         Halfedge he = Halfedge(m, boundaryHe);
         for (auto [a, b] : zip(patch, patchConvexity)) {
             if (b < 0){
@@ -248,55 +850,63 @@ inline int makePatchConcave(int& boundaryHe, std::list<int>& patch, std::list<in
 
                 he = Halfedge(m, a).opposite();
                 fa[he.facet()] = 2;
+                added.push_back(he.facet());
                 hasConcave = true;
             }
         }
+        outline.add(added, fa);
 
         if (updateBoundaryHe(boundaryHe, he, fa, m) == -1)
             return -1;
 
-        if (getPatch(Halfedge(m, boundaryHe), fa, patch, patchConvexity) == -1)
+        if (outline.walk(Halfedge(m, boundaryHe), fa, patch, patchConvexity, segments) == -1)
             return -1;
     }
 
     return 1;
 }
 
-inline int initialPatchConstruction(Vertex v, FacetAttribute<int>& fa, std::list<int>& patch, std::list<int>& patchConvexity, Quads& m, CornerAttribute<int>& ca){
-    // constructing a patch with 3 defects with breath-first search
+inline int initialPatchConstruction(Vertex v, DefectField& field, FacetStates& fa, std::list<int>& patch, std::list<int>& patchConvexity, std::vector<int>& segments, Quads& m, CornerFlags& ca, PatchOutline& outline){
+    // constructing a patch with 3 defects, seeded as the field says
 
-    int boundaryHe = bfs(v.halfedge().facet(), fa, m, ca);
+    int boundaryHe = field.seedPatch(v, fa);
     if (boundaryHe == -1)
         return -1;
 
-    if (getPatch(Halfedge(m, boundaryHe), fa, patch, patchConvexity) == -1)
+    outline.build(fa);
+    if (outline.walk(Halfedge(m, boundaryHe), fa, patch, patchConvexity, segments) == -1)
             return -1;
 
-    if (makePatchConcave(boundaryHe, patch, patchConvexity, fa, m, ca) == -1)
+    if (makePatchConcave(boundaryHe, patch, patchConvexity, segments, fa, m, ca, outline) == -1)
         return -1;
 
-    return postPatch(fa, m, patch, patchConvexity, ca);
+    return postPatch(fa, m, patch, patchConvexity, segments, ca);
 }
 
-inline int expandPatch(std::list<int>& patch, FacetAttribute<int>& fa, Quads& m, std::list<int>& patchConvexity, CornerAttribute<int>& ca){
+inline int expandPatch(std::list<int>& patch, FacetStates& fa, Quads& m, std::list<int>& patchConvexity, std::vector<int>& segments, CornerFlags& ca, PatchOutline& outline){
 
     Halfedge he = Halfedge(m, 1);
+    std::vector<int> added;
     for (int i : patch) {
-        if (ca[Halfedge(m, i)] == 1)
+        if (ca[Halfedge(m, i)] == 1 || Halfedge(m, i).opposite() == -1)
             continue;
         he = Halfedge(m, i).opposite();
         fa[he.facet()] = 2;
+        added.push_back(he.facet());
     }
+    if (added.empty())
+        return failPatch("walled in by hard edges");
+    outline.add(added, fa);
 
     int boundaryHe = 0;
     if (updateBoundaryHe(boundaryHe, he, fa, m) == -1)
         return -1;
 
-    if (getPatch(Halfedge(m, boundaryHe), fa, patch, patchConvexity) == -1)
+    if (outline.walk(Halfedge(m, boundaryHe), fa, patch, patchConvexity, segments) == -1)
         return -1;
 
-    if (makePatchConcave(he, patch, patchConvexity, fa, m, ca) == -1)
+    if (makePatchConcave(he, patch, patchConvexity, segments, fa, m, ca, outline) == -1)
         return -1;
 
-    return postPatch(fa, m, patch, patchConvexity, ca);
+    return postPatch(fa, m, patch, patchConvexity, segments, ca);
 }
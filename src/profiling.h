@@ -0,0 +1,394 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory
+
+inline long peakMemoryKb(){
+    // Peak resident memory of the process, 0 where it isn't known
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // in bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+struct HeapCounters {
+    // Updated by the operators new and delete of the main executable built with BUNIN_HEAP_ACCOUNTING (see main.cpp), while counting is
+    // set, left at 0 otherwise. A program using the bunin library keeps its own operators, so its allocations are never counted
+    std::atomic<bool> counting = false;
+    std::atomic<long> allocations = 0;
+    std::atomic<long> allocatedBytes = 0;
+    std::atomic<long> liveBytes = 0;
+    std::atomic<long> peakLiveBytes = 0;
+
+    void allocated(long size){
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+        long live = liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+        long peak = peakLiveBytes.load(std::memory_order_relaxed);
+        while (live > peak && !peakLiveBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+    }
+
+    void freed(long size){
+        liveBytes.fetch_sub(size, std::memory_order_relaxed);
+    }
+};
+
+inline HeapCounters heapCounters;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Profiling
+
+struct AttemptStats {
+    // Attempts at remeshing around a defect that ended the same way
+    long count = 0;
+    double seconds = 0;
+    long expansions = 0;
+    std::map<int, long> sizes;          // number of facets in the last patch, by power of 2
+    std::map<int, long> expansionCounts;
+};
+
+struct TraceEvent {
+    std::string name;
+    double ts;  // microseconds since the start of the run
+    double dur;
+    int tid;
+    std::string args; // json object, empty if none
+};
+
+struct HotPhaseTotals {
+    long count = 0;
+    double seconds = 0;
+};
+
+using HotPhaseTable = std::map<const char*, HotPhaseTotals>;
+
+inline int traceThreadId(){
+    static std::atomic<int> nbThreads = 0;
+    thread_local int id = nbThreads++;
+    return id;
+}
+
+struct Profiler {
+    // Durations of the phases of the run and counters of events. Nothing is recorded unless enabled, which is the case when a report is asked for.
+    // With tracing, the phases are also kept as a timeline of events, written at the end of the run
+    bool enabled = false;
+    bool tracing = false;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::map<std::string, std::vector<double>> phases;
+    std::map<std::string, long> counters;
+    std::map<std::string, AttemptStats> attempts;
+    std::map<std::string, std::pair<long, long>> phaseMemory; // peak resident memory at the end of the phase, and how much the phase raised it, in kb
+    std::map<std::string, long> structures;                   // largest size seen of each data structure, in bytes
+    std::vector<TraceEvent> events;
+    std::vector<std::shared_ptr<HotPhaseTable>> hotTables;    // one per thread that went through a hot phase, see HotTimer
+    std::mutex mutex; // the phases are also timed by the threads of the smoothing and of the batch mode
+
+    bool active() const {
+        return enabled || tracing;
+    }
+
+    void record(const char* phase, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, bool traced, const std::string& args = ""){
+        std::lock_guard<std::mutex> lock(mutex);
+        if (enabled)
+            phases[phase].push_back(std::chrono::duration<double>(end - start).count());
+        if (tracing && traced)
+            events.push_back({phase, std::chrono::duration<double, std::micro>(start - origin).count(), std::chrono::duration<double, std::micro>(end - start).count(), traceThreadId(), args});
+    }
+
+    HotPhaseTable& hotTable(){
+        // The table of the calling thread, registered the first time, so that a hot phase takes no lock afterwards
+        thread_local std::shared_ptr<HotPhaseTable> table;
+        if (table == nullptr){
+            table = std::make_shared<HotPhaseTable>();
+            std::lock_guard<std::mutex> lock(mutex);
+            hotTables.push_back(table);
+        }
+        return *table;
+    }
+
+    std::map<std::string, HotPhaseTotals> hotPhases(){
+        // The tables of all the threads summed by phase, read once they are done
+        std::map<std::string, HotPhaseTotals> sums;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& table : hotTables)
+            for (auto& [phase, totals] : *table){
+                HotPhaseTotals& sum = sums[phase];
+                sum.count += totals.count;
+                sum.seconds += totals.seconds;
+            }
+        return sums;
+    }
+
+    void recordMemory(const char* phase, long startKb, long endKb){
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& [peak, growth] = phaseMemory[phase];
+        peak = std::max(peak, endKb);
+        growth += endKb - startKb;
+    }
+
+    void structure(const char* name, long bytes){
+        if (!enabled)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        long& largest = structures[name];
+        largest = std::max(largest, bytes);
+    }
+
+    void count(const char* counter, long n = 1){
+        if (!enabled)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        counters[counter] += n;
+    }
+
+    void recordAttempt(const char* outcome, double seconds, int patchSize, int expansions){
+        if (!enabled)
+            return;
+        int bucket = 1;
+        while (bucket < patchSize)
+            bucket *= 2;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        AttemptStats& stats = attempts[outcome];
+        stats.count++;
+        stats.seconds += seconds;
+        stats.expansions += expansions;
+        stats.sizes[bucket]++;
+        stats.expansionCounts[expansions]++;
+    }
+
+    void printAttempts(std::ostream& out){
+        out << "Patch attempts:" << std::endl;
+        for (auto& [outcome, stats] : attempts)
+            out << "    " << std::left << std::setw(24) << outcome << std::right << std::setw(8) << stats.count << " attempts "
+                << std::setw(10) << std::fixed << std::setprecision(3) << stats.seconds << "s "
+                << std::setw(8) << stats.expansions << " expansions" << std::defaultfloat << std::endl;
+    }
+
+    static void writeHistogram(std::ostream& out, const std::map<int, long>& histogram){
+        out << "{";
+        bool first = true;
+        for (auto [value, count] : histogram){
+            out << (first ? "" : ", ") << "\"" << value << "\": " << count;
+            first = false;
+        }
+        out << "}";
+    }
+
+    static std::string escape(const std::string& str){
+        std::string escaped;
+        for (char c : str){
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    bool writeReport(const std::string& path, const std::string& model, int defectsBefore, int defectsAfter){
+        std::ofstream out(path);
+        if (!out.is_open())
+            return false;
+
+        out << std::setprecision(9);
+        out << "{\n";
+        out << "  \"model\": \"" << escape(model) << "\",\n";
+        out << "  \"defects\": {\"before\": " << defectsBefore << ", \"after\": " << defectsAfter << "},\n";
+        // kept on a single line, as it is read by regression.sh
+        out << "  \"run\": {\"seconds\": " << std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count()
+            << ", \"iterations\": " << (phases.count("iteration") ? phases["iteration"].size() : 0) << ", \"peak memory kb\": " << peakMemoryKb() << "},\n";
+
+        // phases may be nested, so their totals don't add up to the duration of the run
+        out << "  \"phases\": {";
+        bool first = true;
+        for (auto& [name, durations] : phases){
+            std::vector<double> sorted = durations;
+            std::sort(sorted.begin(), sorted.end());
+            double total = 0;
+            for (double d : sorted)
+                total += d;
+            auto percentile = [&](double p){ return sorted[std::min(sorted.size()-1, size_t(p*sorted.size()))]; };
+
+            out << (first ? "\n" : ",\n");
+            out << "    \"" << escape(name) << "\": {\"count\": " << sorted.size() << ", \"total\": " << total << ", \"mean\": " << total/sorted.size()
+                << ", \"p50\": " << percentile(.5) << ", \"p90\": " << percentile(.9) << ", \"p99\": " << percentile(.99) << ", \"max\": " << sorted.back();
+            if (phaseMemory.count(name))
+                out << ", \"peak memory kb\": " << phaseMemory[name].first << ", \"memory growth kb\": " << phaseMemory[name].second;
+            out << "}";
+            first = false;
+        }
+        // the hot phases only have their count and total
+        for (auto& [name, totals] : hotPhases()){
+            out << (first ? "\n" : ",\n");
+            out << "    \"" << escape(name) << "\": {\"count\": " << totals.count << ", \"total\": " << totals.seconds << ", \"mean\": " << totals.seconds/totals.count << "}";
+            first = false;
+        }
+        out << "\n  },\n";
+
+        out << "  \"counters\": {";
+        first = true;
+        for (auto& [name, value] : counters){
+            out << (first ? "\n" : ",\n");
+            out << "    \"" << escape(name) << "\": " << value;
+            first = false;
+        }
+        out << "\n  },\n";
+
+        // the heap is only counted by the main executable built with BUNIN_HEAP_ACCOUNTING
+        out << "  \"memory\": {\"peak memory kb\": " << peakMemoryKb();
+        if (heapCounters.counting)
+            out << ", \"heap counted by\": \"main executable\", \"allocations\": " << heapCounters.allocations << ", \"allocated bytes\": " << heapCounters.allocatedBytes
+                << ", \"peak heap bytes\": " << heapCounters.peakLiveBytes;
+        else
+            out << ", \"heap counted by\": \"none\"";
+        out << ", \"structures\": {";
+        first = true;
+        for (auto& [name, bytes] : structures){
+            out << (first ? "\n" : ",\n");
+            out << "    \"" << escape(name) << "\": " << bytes;
+            first = false;
+        }
+        out << "\n  }},\n";
+
+        // sizes are bucketed by the next power of 2, e.g. "64" counts the patches of 33 to 64 facets
+        out << "  \"patch attempts\": {";
+        first = true;
+        for (auto& [outcome, stats] : attempts){
+            out << (first ? "\n" : ",\n");
+            out << "    \"" << escape(outcome) << "\": {\"count\": " << stats.count << ", \"seconds\": " << stats.seconds << ", \"expansions\": " << stats.expansions << ", \"sizes\": ";
+            writeHistogram(out, stats.sizes);
+            out << ", \"expansion counts\": ";
+            writeHistogram(out, stats.expansionCounts);
+            out << "}";
+            first = false;
+        }
+        out << "\n  }\n";
+        out << "}\n";
+
+        return true;
+    }
+
+    bool writeTrace(const std::string& path){
+        // Chrome trace event format, readable by chrome://tracing and Perfetto
+        std::ofstream out(path);
+        if (!out.is_open())
+            return false;
+
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        bool first = true;
+        for (TraceEvent& event : events){
+            out << (first ? "\n" : ",\n");
+            out << "{\"name\": \"" << escape(event.name) << "\", \"cat\": \"bunin\", \"ph\": \"X\", \"ts\": " << event.ts << ", \"dur\": " << event.dur
+                << ", \"pid\": 1, \"tid\": " << event.tid;
+            if (!event.args.empty())
+                out << ", \"args\": " << event.args;
+            out << "}";
+            first = false;
+        }
+        out << "\n]}\n";
+
+        return true;
+    }
+};
+
+inline Profiler profiler;
+
+struct PatchAttempt {
+    // Times the attempt at remeshing around a defect, until its outcome is known
+    int vertex;
+    std::chrono::steady_clock::time_point start;
+
+    PatchAttempt(int vertex) : vertex(vertex) {
+        if (profiler.active())
+            start = std::chrono::steady_clock::now();
+    }
+
+    void end(const char* outcome, int patchSize, int expansions){
+        if (!profiler.active())
+            return;
+        auto now = std::chrono::steady_clock::now();
+        profiler.recordAttempt(outcome, std::chrono::duration<double>(now - start).count(), patchSize, expansions);
+        if (profiler.tracing)
+            profiler.record("attempt", start, now, true, "{\"vertex\": " + std::to_string(vertex) + ", \"outcome\": \"" + outcome + "\", \"expansions\": " + std::to_string(expansions) + ", \"size\": " + std::to_string(patchSize) + "}");
+    }
+};
+
+inline thread_local int timerDepth = 0; // ScopedTimers running on the thread
+
+struct ScopedTimer {
+    // Records the time spent between its construction and its destruction, or the call to stop() for a phase that doesn't match a scope.
+    // The memory is only measured around the phases started outside of any other one, getrusage costing more than most of the inner phases
+    const char* phase;
+    bool running;
+    bool topLevel = false;
+    std::chrono::steady_clock::time_point start;
+    std::string args; // shown on the trace event, only worth filling when tracing
+    long startMemoryKb = 0;
+
+    ScopedTimer(const char* phase) : phase(phase), running(profiler.active()) {
+        if (!running)
+            return;
+        topLevel = timerDepth++ == 0;
+        if (topLevel && profiler.enabled)
+            startMemoryKb = peakMemoryKb();
+        start = std::chrono::steady_clock::now();
+    }
+
+    void stop(){
+        if (!running)
+            return;
+        running = false;
+        timerDepth--;
+        profiler.record(phase, start, std::chrono::steady_clock::now(), true, args);
+        if (topLevel && profiler.enabled)
+            profiler.recordMemory(phase, startMemoryKb, peakMemoryKb());
+    }
+
+    ~ScopedTimer(){
+        stop();
+    }
+};
+
+struct HotTimer {
+    // Times a phase called too often to be recorded one call at a time, like a single projection. Each thread adds the count and the
+    // total time to its own table without locking, and the report sums the tables. Left out of the trace and of the memory accounting
+    const char* phase;
+    bool running;
+    std::chrono::steady_clock::time_point start;
+
+    HotTimer(const char* phase) : phase(phase), running(profiler.enabled) {
+        if (running)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ~HotTimer(){
+        if (!running)
+            return;
+        HotPhaseTotals& totals = profiler.hotTable()[phase];
+        totals.count++;
+        totals.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
@@ -0,0 +1,718 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ultimaille/all.h>
+#include "packedAttributes.h"
+#include "patchFinding.h"
+#include "profiling.h"
+#ifdef _WIN32
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace UM;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reading large meshes
+//
+// The .mesh and .obj files are memory mapped, and their lines parsed in parallel chunks. Each record is expected on a line of its own, as all
+// the writers do; any file this parser doesn't understand, or with facets that aren't quads, is left to read_by_extension.
+// The connectivity is then built in parallel too, see connectParallel
+
+struct MappedFile {
+    // The whole file in memory, mapped where it can be, read otherwise
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    std::vector<char> buffer;
+
+    explicit MappedFile(const std::string& path){
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open())
+            return;
+        buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+    }
+#else
+    explicit MappedFile(const std::string& path){
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0){
+            void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED){
+                data = static_cast<const char*>(mapped);
+                size = st.st_size;
+                madvise(mapped, size, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFile(){
+        if (data != nullptr)
+            munmap(const_cast<char*>(data), size);
+    }
+#endif
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+struct LineParser {
+    // Numbers of a single line, from begin to end
+    const char* p;
+    const char* end;
+
+    void skipSpaces(){
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
+    }
+
+    bool number(double& value){
+        skipSpaces();
+        if (p < end && *p == '+')
+            p++;
+        auto [next, error] = std::from_chars(p, end, value);
+        p = next;
+        return error == std::errc();
+    }
+
+    bool number(int& value){
+        skipSpaces();
+        auto [next, error] = std::from_chars(p, end, value);
+        p = next;
+        return error == std::errc();
+    }
+
+    void skipToken(){
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+            p++;
+    }
+
+    std::string_view word(){
+        skipSpaces();
+        const char* start = p;
+        skipToken();
+        return {start, size_t(p - start)};
+    }
+};
+
+inline const char* lineEnd(const char* p, const char* end){
+    const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return newline == nullptr ? end : newline;
+}
+
+inline const char* nextLine(const char* p, const char* end){
+    const char* newline = lineEnd(p, end);
+    return newline == end ? end : newline + 1;
+}
+
+inline std::vector<const char*> splitLines(const char* begin, const char* end, int nbChunks){
+    // Boundaries of nbChunks ranges of whole lines, of about the same size
+    std::vector<const char*> bounds = {begin};
+    for (int i = 1; i < nbChunks; i++){
+        const char* p = begin + (end - begin) * i / nbChunks;
+        if (p > begin && p[-1] != '\n')
+            p = nextLine(p, end);
+        bounds.push_back(std::max(p, bounds.back()));
+    }
+    bounds.push_back(end);
+    return bounds;
+}
+
+inline int readingChunks(){
+#ifdef _OPENMP
+    return 4*omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+template <class ParseLine>
+inline bool parseBlock(const char*& p, const char* end, int n, ParseLine parseLine){
+    // The n lines starting at p, parseLine(i, parser) reading the i-th one. The lines starting each chunk are found by a first pass over
+    // the line ends, which is much faster than reading the numbers, so only the numbers are read in parallel
+    int nbChunks = std::max(1, std::min(readingChunks(), n / 1024));
+    int chunkSize = (n + nbChunks - 1) / nbChunks;
+    std::vector<const char*> starts;
+    std::vector<int> firsts;
+    for (int i = 0; i < n; i++){
+        if (p >= end)
+            return false;
+        if (i % chunkSize == 0){
+            starts.push_back(p);
+            firsts.push_back(i);
+        }
+        p = nextLine(p, end);
+    }
+    firsts.push_back(n);
+
+    bool ok = true;
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (int chunk = 0; chunk < (int)starts.size(); chunk++){
+        const char* line = starts[chunk];
+        for (int i = firsts[chunk]; i < firsts[chunk + 1] && ok; i++){
+            const char* eol = lineEnd(line, end);
+            LineParser parser{line, eol};
+            ok = parseLine(i, parser);
+            line = eol == end ? end : eol + 1;
+        }
+    }
+    return ok;
+}
+
+inline bool readMedit(const MappedFile& file, std::vector<vec3>& points, std::vector<int>& quads){
+    // The keywords are read one after the other, and the vertices and quadrilaterals blocks parsed in parallel. The other blocks are skipped,
+    // but the triangles, that Quads can't hold
+    const char* p = file.data;
+    const char* end = file.data + file.size;
+    auto readWord = [&](){
+        while (p < end && std::isspace((unsigned char)*p))
+            p++;
+        const char* start = p;
+        while (p < end && !std::isspace((unsigned char)*p))
+            p++;
+        return std::string_view(start, p - start);
+    };
+    auto readCount = [&](int& n){
+        std::string_view word = readWord();
+        auto [next, error] = std::from_chars(word.data(), word.data() + word.size(), n);
+        // the block starts on the next line
+        p = nextLine(p, end);
+        return error == std::errc() && n >= 0;
+    };
+
+    bool hasVertices = false;
+    while (p < end){
+        std::string_view keyword = readWord();
+        if (keyword.empty() || keyword == "End")
+            break;
+
+        int n;
+        if (keyword == "MeshVersionFormatted"){
+            if (!readCount(n))
+                return false;
+        } else if (keyword == "Dimension"){
+            if (!readCount(n) || n != 3)
+                return false;
+        } else if (keyword == "Vertices"){
+            if (!readCount(n))
+                return false;
+            points.resize(n);
+            hasVertices = true;
+            bool ok = parseBlock(p, end, n, [&](int i, LineParser& line){
+                return line.number(points[i].x) && line.number(points[i].y) && line.number(points[i].z);
+            });
+            if (!ok)
+                return false;
+        } else if (keyword == "Quadrilaterals"){
+            if (!readCount(n))
+                return false;
+            int offset = quads.size();
+            quads.resize(offset + 4*n);
+            bool ok = parseBlock(p, end, n, [&](int i, LineParser& line){
+                int* quad = quads.data() + offset + 4*i;
+                return line.number(quad[0]) && line.number(quad[1]) && line.number(quad[2]) && line.number(quad[3]);
+            });
+            if (!ok)
+                return false;
+        } else if (keyword == "Triangles"){
+            if (!readCount(n) || n > 0)
+                return false;
+        } else {
+            // a block of one line per element
+            if (!readCount(n))
+                return false;
+            for (int i = 0; i < n && p < end; i++)
+                p = nextLine(p, end);
+        }
+    }
+    if (!hasVertices)
+        return false;
+
+    // from the 1-based ids of the file
+    int nverts = points.size();
+    bool ok = true;
+    #pragma omp parallel for reduction(&&:ok)
+    for (int c = 0; c < (int)quads.size(); c++){
+        quads[c]--;
+        ok = ok && quads[c] >= 0 && quads[c] < nverts;
+    }
+    return ok;
+}
+
+inline bool readObj(const MappedFile& file, std::vector<vec3>& points, std::vector<int>& quads){
+    // The lines are split in chunks, whose vertices and faces are counted in a first parallel pass, then read in a second one at the ids
+    // following the ones of the previous chunks, as the negative ids of the faces are relative to the vertices before them
+    const char* begin = file.data;
+    const char* end = file.data + file.size;
+    std::vector<const char*> bounds = splitLines(begin, end, readingChunks());
+    int nbChunks = bounds.size() - 1;
+
+    auto lineType = [](LineParser& line){
+        std::string_view word = line.word();
+        return word == "v" ? 'v' : word == "f" ? 'f' : ' ';
+    };
+
+    std::vector<int> nbPoints(nbChunks + 1, 0);
+    std::vector<int> nbQuads(nbChunks + 1, 0);
+    #pragma omp parallel for schedule(dynamic)
+    for (int chunk = 0; chunk < nbChunks; chunk++)
+        for (const char* p = bounds[chunk]; p < bounds[chunk + 1]; p = nextLine(p, end)){
+            LineParser line{p, lineEnd(p, end)};
+            char type = lineType(line);
+            nbPoints[chunk + 1] += type == 'v';
+            nbQuads[chunk + 1] += type == 'f';
+        }
+    for (int chunk = 0; chunk < nbChunks; chunk++){
+        nbPoints[chunk + 1] += nbPoints[chunk];
+        nbQuads[chunk + 1] += nbQuads[chunk];
+    }
+    if (nbPoints[nbChunks] == 0)
+        return false;
+
+    points.resize(nbPoints[nbChunks]);
+    quads.resize(4*nbQuads[nbChunks]);
+    int nverts = points.size();
+    bool ok = true;
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (int chunk = 0; chunk < nbChunks; chunk++){
+        int v = nbPoints[chunk];
+        int f = nbQuads[chunk];
+        for (const char* p = bounds[chunk]; p < bounds[chunk + 1] && ok; p = nextLine(p, end)){
+            LineParser line{p, lineEnd(p, end)};
+            char type = lineType(line);
+            if (type == 'v'){
+                ok = line.number(points[v].x) && line.number(points[v].y) && line.number(points[v].z);
+                v++;
+            } else if (type == 'f'){
+                // a/b/c, a//c and a/b give the vertex a
+                for (int i = 0; i < 4 && ok; i++){
+                    int id;
+                    ok = line.number(id) && id != 0;
+                    id = id > 0 ? id - 1 : v + id;
+                    ok = ok && id >= 0 && id < nverts;
+                    quads[4*f + i] = id;
+                    line.skipToken();
+                }
+                ok = ok && line.word().empty();
+                f++;
+            }
+        }
+    }
+    return ok;
+}
+
+inline bool mappedRead(Quads& m, const std::string& path){
+    // False if the file isn't a .mesh or an .obj this parser can read, m being left empty
+    std::string extension = path.substr(path.find_last_of('.') + 1);
+    if (extension != "mesh" && extension != "obj")
+        return false;
+
+    MappedFile file(path);
+    if (file.data == nullptr)
+        return false;
+
+    std::vector<vec3> points;
+    std::vector<int> quads;
+    if (!(extension == "mesh" ? readMedit(file, points, quads) : readObj(file, points, quads)))
+        return false;
+
+    m.points.create_points(points.size());
+    #pragma omp parallel for
+    for (int v = 0; v < (int)points.size(); v++)
+        m.points[v] = points[v];
+    m.create_facets(quads.size()/4);
+    std::copy(quads.begin(), quads.end(), m.facets.begin());
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Connectivity
+//
+// The arrays of the connectivity of ultimaille are the facet of each corner, the previous corner around its vertex, and the last corner of
+// each vertex, connect() filling them in the order of the corners. The corners are sorted by vertex here, and the halfedges by the vertices
+// of their edge to pair the opposites, with a parallel counting sort then a sort of each bucket, small as it only holds the corners of a vertex
+
+template <class Bucket, class Less>
+inline void bucketSort(int n, int nbBuckets, Bucket bucket, Less less, std::vector<int>& offsets, std::vector<int>& sorted){
+    // The items 0 to n-1 sorted by bucket, then by less inside of each bucket, which starts at its offset
+    offsets.assign(nbBuckets + 1, 0);
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++){
+        #pragma omp atomic
+        offsets[bucket(i) + 1]++;
+    }
+    for (int b = 0; b < nbBuckets; b++)
+        offsets[b + 1] += offsets[b];
+
+    // the items reach their bucket in any order, which the sort of the buckets makes up for
+    std::vector<int> next(offsets.begin(), offsets.end() - 1);
+    sorted.resize(n);
+    #pragma omp parallel for
+    for (int i = 0; i < n; i++){
+        int position;
+        #pragma omp atomic capture
+        position = next[bucket(i)]++;
+        sorted[position] = i;
+    }
+    #pragma omp parallel for schedule(dynamic, 4096)
+    for (int b = 0; b < nbBuckets; b++)
+        std::sort(sorted.begin() + offsets[b], sorted.begin() + offsets[b + 1], less);
+}
+
+inline void setConnectivity(Quads& m, std::vector<int>& c2f, std::vector<int>& c2c, std::vector<int>& v2c){
+    // connect() on the mesh without its facets costs nothing, its arrays are then swapped for these ones
+    std::vector<int> facets;
+    m.facets.swap(facets);
+    m.connect();
+    m.facets.swap(facets);
+    m.conn->c2f.swap(c2f);
+    m.conn->c2c.swap(c2c);
+    m.conn->v2c.swap(v2c);
+    m.conn->active.assign(m.nfacets(), true);
+}
+
+inline int connectParallel(Quads& m, std::vector<int>* opposites = nullptr){
+    // Connects m as connect() does, and sets opposites to the opposite of each halfedge, -1 on a border. Returns the number of non manifold
+    // edges, with more than two halfedges or two going the same way, which are given no opposite
+    int ncorners = m.ncorners();
+    std::vector<int> c2f(ncorners);
+    #pragma omp parallel for
+    for (int c = 0; c < ncorners; c++)
+        c2f[c] = c / 4;
+
+    // the corners of a vertex in their order, each one after the previous one
+    std::vector<int> offsets;
+    std::vector<int> sorted;
+    bucketSort(ncorners, m.nverts(), [&](int c){ return m.facets[c]; }, std::less<int>(), offsets, sorted);
+    std::vector<int> c2c(ncorners);
+    std::vector<int> v2c(m.nverts());
+    #pragma omp parallel for
+    for (int v = 0; v < m.nverts(); v++){
+        v2c[v] = offsets[v + 1] > offsets[v] ? sorted[offsets[v + 1] - 1] : -1;
+        for (int i = offsets[v]; i < offsets[v + 1]; i++)
+            c2c[sorted[i]] = i > offsets[v] ? sorted[i - 1] : -1;
+    }
+
+    // the halfedges of an edge next to each other, by the smaller then the larger vertex of the edge
+    auto from = [&](int c){ return m.facets[c]; };
+    auto to = [&](int c){ return m.facets[4*(c/4) + (c + 1)%4]; };
+    std::vector<uint64_t> keys(ncorners);
+    #pragma omp parallel for
+    for (int c = 0; c < ncorners; c++)
+        keys[c] = uint64_t(std::max(from(c), to(c))) << 32 | uint32_t(c);
+    bucketSort(ncorners, m.nverts(), [&](int c){ return std::min(from(c), to(c)); }, [&](int a, int b){ return keys[a] < keys[b]; }, offsets, sorted);
+    std::vector<int> opposite(opposites != nullptr ? ncorners : 0);
+    int nonManifold = 0;
+    #pragma omp parallel for reduction(+:nonManifold)
+    for (int v = 0; v < m.nverts(); v++)
+        for (int i = offsets[v], end = i; i < offsets[v + 1]; i = end){
+            while (end < offsets[v + 1] && keys[sorted[end]] >> 32 == keys[sorted[i]] >> 32)
+                end++;
+            bool paired = end - i == 2 && from(sorted[i]) != from(sorted[i + 1]);
+            nonManifold += end - i > 2 || (end - i == 2 && !paired);
+            if (opposites != nullptr)
+                for (int j = i; j < end; j++)
+                    opposite[sorted[j]] = paired ? sorted[2*i + 1 - j] : -1;
+        }
+
+    setConnectivity(m, c2f, c2c, v2c);
+    if (opposites != nullptr)
+        opposites->swap(opposite);
+    return nonManifold;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cached meshes
+//
+// A copy of the mesh as it is in memory once connected, behind a header giving its numbers and the size and date of the file it was read
+// from: the points and the facets, the connectivity of ultimaille (the facet and the next corner around the vertex of each corner, and a
+// corner per vertex), the hard edges of the cad mode, see markHardEdges, and the selected facets when read with a selection. Mapping it back
+// is a copy of these arrays, with no parsing and no connect(). It is rewritten when the file has changed.
+// The arrays of the connectivity are the ones of the ultimaille the cache was written with, so a cache is only read back by a build of the
+// same commit of ultimaille, given by CMake in ULTIMAILLE_COMMIT. A build that doesn't know its commit doesn't use the cache
+
+#ifndef ULTIMAILLE_COMMIT
+#define ULTIMAILLE_COMMIT ""
+#endif
+
+struct CacheHeader {
+    char magic[8] = {'B', 'U', 'N', 'I', 'N', 'M', 'S', 'H'};
+    uint32_t version = 4;
+    char ultimaille[48] = ULTIMAILLE_COMMIT;
+    uint32_t vec3Size = sizeof(vec3);   // the points are written as they are in memory
+    uint64_t sourceSize = 0;
+    int64_t sourceTime = 0;
+    int64_t nverts = 0;
+    int64_t nfacets = 0;
+    int64_t selection = 0;              // 1 if the selected facets follow the hard edges
+
+    uint64_t bytes() const {
+        int64_t ncorners = 4*nfacets;
+        return sizeof(CacheHeader) + nverts*sizeof(vec3) + 3*ncorners*sizeof(int) + nverts*sizeof(int) + (ncorners + 63)/64*sizeof(uint64_t)
+            + selection*(nfacets + 63)/64*sizeof(uint64_t);
+    }
+};
+
+inline std::string cacheFile(const std::string& cacheDir, const std::string& path, const std::string& selection = ""){
+    // named after the file, with a hash of its full path to tell apart the files of the same name, and of the attributes of the selection
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::absolute(path, error);
+    std::stringstream name;
+    name << std::filesystem::path(path).stem().string() << "-" << std::hex << std::hash<std::string>()(absolute.string() + "\n" + selection) << ".cache";
+    return (std::filesystem::path(cacheDir) / name.str()).string();
+}
+
+inline bool cacheSource(const std::string& path, CacheHeader& header){
+    std::error_code error;
+    header.sourceSize = std::filesystem::file_size(path, error);
+    if (error)
+        return false;
+    header.sourceTime = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    return !error;
+}
+
+inline bool readIndices(std::vector<int>& to, const char*& from, int64_t n, int64_t end){
+    // n ids from the cache, each one -1 or below end, so that a damaged cache is never followed out of the mesh
+    to.resize(n);
+    std::memcpy(to.data(), from, n*sizeof(int));
+    from += n*sizeof(int);
+    bool ok = true;
+    #pragma omp parallel for reduction(&&:ok)
+    for (int64_t i = 0; i < n; i++)
+        ok = ok && to[i] >= -1 && to[i] < end;
+    return ok;
+}
+
+inline bool readCache(Quads& m, const std::string& file, const std::string& source, CornerFlags* hardEdges = nullptr, std::vector<bool>* selection = nullptr){
+    // False if there is no cache of source in file, with the selection if asked for, or if it is out of date or damaged, m being left empty.
+    // Otherwise m is connected
+    CacheHeader expected;
+    if (!cacheSource(source, expected))
+        return false;
+
+    MappedFile mapped(file);
+    if (mapped.data == nullptr || mapped.size < sizeof(CacheHeader))
+        return false;
+    CacheHeader header;
+    std::memcpy(&header, mapped.data, sizeof(header));
+    if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version
+        || expected.ultimaille[0] == 0 || std::memcmp(header.ultimaille, expected.ultimaille, sizeof(header.ultimaille)) != 0 || header.vec3Size != expected.vec3Size
+        || header.sourceSize != expected.sourceSize || header.sourceTime != expected.sourceTime || header.nverts <= 0 || header.nfacets < 0
+        || header.nverts > INT_MAX || 4*header.nfacets > INT_MAX || header.selection != (selection != nullptr) || mapped.size != header.bytes())
+        return false;
+
+    const char* data = mapped.data + sizeof(header);
+    m.points.create_points(header.nverts);
+    #pragma omp parallel for
+    for (int v = 0; v < (int)header.nverts; v++)
+        std::memcpy(&m.points[v], data + v*sizeof(vec3), sizeof(vec3));
+    data += header.nverts*sizeof(vec3);
+    m.create_facets(header.nfacets); // for the attributes bound to m
+
+    // the arrays of the connectivity are the ones connect() made when the cache was written, so the walks around the vertices start and
+    // turn the same way
+    int ncorners = 4*header.nfacets;
+    std::vector<int> facets, c2f, c2c, v2c;
+    bool ok = readIndices(facets, data, ncorners, header.nverts)
+        && std::find(facets.begin(), facets.end(), -1) == facets.end();
+    m.facets.swap(facets);
+    ok = ok && readIndices(c2f, data, ncorners, header.nfacets)
+            && readIndices(c2c, data, ncorners, ncorners)
+            && readIndices(v2c, data, header.nverts, ncorners);
+    setConnectivity(m, c2f, c2c, v2c);
+
+    if (ok && hardEdges != nullptr)
+        std::memcpy(hardEdges->ptr->words.data(), data, hardEdges->ptr->words.size()*sizeof(uint64_t));
+    data += (ncorners + 63)/64*sizeof(uint64_t);
+    if (ok && selection != nullptr){
+        selection->assign(header.nfacets, false);
+        for (int f = 0; f < header.nfacets; f++){
+            uint64_t word;
+            std::memcpy(&word, data + f/64*sizeof(uint64_t), sizeof(word));
+            (*selection)[f] = (word >> (f % 64)) & 1;
+        }
+    }
+    if (!ok){
+        m.disconnect();
+        m.delete_facets(std::vector<bool>(m.nfacets(), true));
+        m.delete_isolated_vertices();
+    }
+    return ok;
+}
+
+inline bool writeCache(Quads& m, const std::string& file, const std::string& source, CornerFlags& hardEdges, const std::vector<bool>* selection = nullptr){
+    // Written next to file then renamed, so a run reading it meanwhile, from another process of a batch, never sees half of it. m must be
+    // connected. The file written is removed on failure
+    CacheHeader header;
+    if (header.ultimaille[0] == 0 || !cacheSource(source, header))
+        return false;
+    header.nverts = m.nverts();
+    header.nfacets = m.nfacets();
+    header.selection = selection != nullptr;
+
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(file).parent_path(), error);
+    std::string temporary = file + "." + std::to_string(std::random_device()()) + ".tmp";
+    std::ofstream out(temporary, std::ios::binary);
+    auto write = [&](const auto& values){
+        out.write(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(values[0]));
+    };
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (int v = 0; v < m.nverts(); v++)
+        out.write(reinterpret_cast<const char*>(&m.points[v]), sizeof(vec3));
+    write(m.facets);
+    write(m.conn->c2f);
+    write(m.conn->c2c);
+    write(m.conn->v2c);
+    write(hardEdges.ptr->words);
+    if (selection != nullptr){
+        std::vector<uint64_t> words((m.nfacets() + 63)/64, 0);
+        for (int f = 0; f < m.nfacets(); f++)
+            words[f/64] |= uint64_t((*selection)[f]) << (f % 64);
+        write(words);
+    }
+    out.close();
+
+    if (out)
+        std::filesystem::rename(temporary, file, error);
+    if (!out || error){
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+inline void connectRead(Quads& m, const std::string& path, const std::string& cache, CornerFlags* hardEdges, const std::vector<bool>* selection = nullptr){
+    // The end of the reading of a file: the connectivity, the hard edges if asked for, and the cache if there is one
+    ScopedTimer connectTimer("connect");
+    int nonManifold = connectParallel(m);
+    connectTimer.stop();
+    if (nonManifold > 0)
+        std::cerr << "Warning: " << path << " has " << nonManifold << " non manifold edges" << std::endl;
+
+    // the hard edges are cached even when they aren't asked for, so that a later run in cad mode finds them
+    if (hardEdges == nullptr && cache.empty())
+        return;
+    std::unique_ptr<CornerFlags> marked = hardEdges == nullptr ? std::make_unique<CornerFlags>(m) : nullptr;
+    CornerFlags& flags = hardEdges == nullptr ? *marked : *hardEdges;
+    ScopedTimer hardEdgesTimer("markHardEdges");
+    markHardEdges(m, flags);
+    hardEdgesTimer.stop();
+
+    if (!cache.empty() && !writeCache(m, cache, path, flags, selection))
+        std::cerr << "Error: can't write the cache in " << cache << std::endl;
+}
+
+inline bool readInput(Quads& m, const std::string& path, const std::string& cacheDir = "", CornerFlags* hardEdges = nullptr){
+    // The mesh connected, and its hard edges if asked for, on an attribute of m. From the cache when there is one up to date, then the
+    // large .mesh and .obj files are much faster to read in parallel, the other files being read by ultimaille. The connectivity is then
+    // built in parallel, with the corner lists connect() would make. With a cache directory, the mesh read from the file is cached for the
+    // next runs. False if the mesh is empty
+    std::string cache = cacheDir.empty() ? "" : cacheFile(cacheDir, path);
+    if (!cache.empty() && readCache(m, cache, path, hardEdges))
+        return true;
+
+    if (!mappedRead(m, path))
+        read_by_extension(path, m);
+    if (m.nverts() == 0)
+        return false;
+
+    connectRead(m, path, cache, hardEdges);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Selection
+
+inline bool attributeValues(const NamedContainerList& attributes, std::string name, std::vector<bool>& values){
+    // The values of the attribute, true where they aren't 0, for the bool, int and double attributes. The name may be given with the
+    // prefix of its elements, as "facets.selection". False if the mesh has no such attribute
+    for (const std::string prefix : {"vertices.", "facets."})
+        if (name.rfind(prefix, 0) == 0)
+            name = name.substr(prefix.size());
+
+    for (const auto& [attributeName, container] : attributes){
+        if (attributeName != name)
+            continue;
+        if (auto data = std::dynamic_pointer_cast<AttributeContainer<bool>>(container)){
+            values.assign(data->data.begin(), data->data.end());
+            return true;
+        }
+        if (auto data = std::dynamic_pointer_cast<AttributeContainer<int>>(container)){
+            values.resize(data->data.size());
+            for (int i = 0; i < (int)values.size(); i++)
+                values[i] = data->data[i] != 0;
+            return true;
+        }
+        if (auto data = std::dynamic_pointer_cast<AttributeContainer<double>>(container)){
+            values.resize(data->data.size());
+            for (int i = 0; i < (int)values.size(); i++)
+                values[i] = data->data[i] != 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool readSelection(Quads& m, const std::string& path, const std::string& facetAttribute, const std::string& vertexAttribute, std::vector<bool>& selection, const std::string& cacheDir = ""){
+    // Reads the mesh connected, with the selected facets: the ones of the facet attribute, and the ones touching a vertex of the vertex
+    // attribute. Only the readers of ultimaille keep the attributes, so the parallel reader isn't used, but the cache keeps the selection
+    // with the mesh, under the names of the attributes. False if the mesh is empty or an attribute is missing
+    std::string cache = cacheDir.empty() ? "" : cacheFile(cacheDir, path, facetAttribute + "\n" + vertexAttribute);
+    if (!cache.empty() && readCache(m, cache, path, nullptr, &selection))
+        return true;
+
+    SurfaceAttributes attributes = read_by_extension(path, m);
+    if (m.nverts() == 0)
+        return false;
+
+    selection.assign(m.nfacets(), false);
+    std::vector<bool> values;
+    if (!facetAttribute.empty()){
+        if (!attributeValues(attributes.facets, facetAttribute, values) || (int)values.size() != m.nfacets()){
+            std::cerr << "Error: " << path << " has no facet attribute " << facetAttribute << std::endl;
+            return false;
+        }
+        selection = values;
+    }
+    if (!vertexAttribute.empty()){
+        if (!attributeValues(attributes.points, vertexAttribute, values) || (int)values.size() != m.nverts()){
+            std::cerr << "Error: " << path << " has no vertex attribute " << vertexAttribute << std::endl;
+            return false;
+        }
+        for (int f = 0; f < m.nfacets(); f++)
+            for (int i = 0; i < 4; i++)
+                if (values[m.vert(f, i)])
+                    selection[f] = true;
+    }
+
+    connectRead(m, path, cache, nullptr, &selection);
+    return true;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+#include <ultimaille/all.h>
+#include "animation.h"
+#include "packedAttributes.h"
+
+using namespace UM;
+using Halfedge = typename Surface::Halfedge;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Region
+//
+// Remeshing a selection of the facets only: they are copied with the ring of facets sharing a vertex with them into a mesh of their own,
+// which is remeshed instead of the whole mesh, then put back in place of the selection. The ring gives the vertices on the border of the
+// selection all their facets, so their valence is the one they have in the mesh. It is frozen: its edges are walls for the defect field and
+// the patches, like hard edges, the defects touching it aren't tried, and a patch including one of its facets is rejected. The remeshing
+// then costs the size of the selection, the mesh itself being only read and written in a few linear passes
+
+struct Region {
+    Quads m;
+    PointAttribute<int> origin{m.points, -1};  // vertex of the mesh each vertex was copied from, -1 for the ones created by the remeshing
+    FacetFlags frozen{m};                       // the ring around the selection
+    FacetAttribute<int> patch{m, 0};
+    CornerAttribute<int> hardEdges{m, 0};      // the hard edges of the mesh, and the walls around the ring once remeshed, see markFrozenWalls
+};
+
+inline int extractRegion(Quads& m, const std::vector<bool>& selection, CornerAttribute<int>& hardEdges, Region& region){
+    // Copies the selected facets and their ring in the empty region. Returns the number of selected facets
+    std::vector<bool> selectedVertex(m.nverts(), false);
+    int nbSelected = 0;
+    for (int f = 0; f < m.nfacets(); f++)
+        if (selection[f]){
+            nbSelected++;
+            for (int i = 0; i < 4; i++)
+                selectedVertex[m.vert(f, i)] = true;
+        }
+
+    std::vector<int> facets;
+    std::vector<bool> ring;
+    for (int f = 0; f < m.nfacets(); f++){
+        bool touching = false;
+        for (int i = 0; i < 4; i++)
+            touching = touching || selectedVertex[m.vert(f, i)];
+        if (selection[f] || touching){
+            facets.push_back(f);
+            ring.push_back(!selection[f]);
+        }
+    }
+
+    // the vertices in the order the facets use them
+    std::vector<int> newId(m.nverts(), -1);
+    std::vector<int> vertices;
+    region.m.create_facets(facets.size());
+    for (int k = 0; k < (int)facets.size(); k++){
+        for (int i = 0; i < 4; i++){
+            int v = m.vert(facets[k], i);
+            if (newId[v] == -1){
+                newId[v] = vertices.size();
+                vertices.push_back(v);
+            }
+            region.m.vert(k, i) = newId[v];
+            region.hardEdges[4*k + i] = hardEdges[4*facets[k] + i];
+        }
+        region.frozen[k] = ring[k];
+    }
+    region.m.points.create_points(vertices.size());
+    for (int v = 0; v < (int)vertices.size(); v++){
+        region.m.points[v] = m.points[vertices[v]];
+        region.origin[v] = vertices[v];
+    }
+    return nbSelected;
+}
+
+inline void mergeRegion(Quads& m, const std::vector<bool>& selection, Region& region, FacetAttribute<int>& patch, CornerAttribute<int>& hardEdges){
+    // Replaces the selected facets of m by the facets of the remeshed region that aren't in the ring, which is still in m as it was.
+    // The new facets are at the end of m, with the patch and hard edges they had in the region
+    std::vector<int> id(region.m.nverts());
+    std::vector<vec3> points;
+    for (int v = 0; v < region.m.nverts(); v++){
+        if (region.origin[v] >= 0){
+            // the smoothing may have moved it
+            id[v] = region.origin[v];
+            m.points[id[v]] = region.m.points[v];
+        } else {
+            id[v] = m.nverts() + points.size();
+            points.push_back(region.m.points[v]);
+        }
+    }
+
+    std::vector<int> kept;
+    std::vector<int> quads;
+    for (int f = 0; f < region.m.nfacets(); f++)
+        if (!region.frozen[f]){
+            kept.push_back(f);
+            for (int i = 0; i < 4; i++)
+                quads.push_back(id[region.m.vert(f, i)]);
+        }
+
+    m.disconnect();
+    replaceFacets(m, selection, points, quads);
+    m.connect();
+
+    int offset = m.nfacets() - kept.size();
+    for (int k = 0; k < (int)kept.size(); k++){
+        patch[offset + k] = region.patch[kept[k]];
+        for (int i = 0; i < 4; i++)
+            hardEdges[4*(offset + k) + i] = region.hardEdges[4*kept[k] + i];
+    }
+
+    // the walls on the border of the selection aren't hard edges: its halfedges get back the value of their opposite, outside of it
+    for (int c = 4*offset; c < m.ncorners(); c++){
+        Halfedge he(m, c);
+        if (he.opposite() != -1 && he.opposite().facet() < offset)
+            hardEdges[he] = hardEdges[he.opposite()];
+    }
+}
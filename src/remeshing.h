@@ -3,14 +3,18 @@
 #include <iterator>
 #include <list>
 #include <ostream>
+#include <string>
 #include <ultimaille/all.h>
 #include <utility>
 #include <vector>
 #include "ultimaille/algebra/vec.h"
+#include "animation.h"
 #include "matrixEquations.h"
+#include "patchFinding.h"
 #include "ultimaille/attributes.h"
 #include "ultimaille/surface.h"
 #include "bvh.h"
+#include "profiling.h"
 #include <assert.h>
 
 using namespace UM;
@@ -25,16 +29,124 @@ inline int pyMod(int a, int b){
     return (a%b+b)%b;
 }
 
-inline void cleaningTopology(Quads& m, FacetAttribute<int>& fa){
-    for (int i=0; i < m.nfacets(); i++){
-        if (fa[i] > 0){
-            m.conn.get()->active[i] = false;
+// Storage of the remesh buffer, kept by each thread from one remesh to the next, and from one mesh to the next in batch mode,
+// so it is only allocated again for a patch larger than the previous ones
+inline thread_local std::vector<vec3> remeshPoints;
+inline thread_local std::vector<int> remeshQuads;
+
+struct RemeshBuffer {
+    // The remeshing of a patch is written here rather than in the mesh, so it can be checked before being committed.
+    // New points get the ids following the vertices of the mesh, so the quads can use them alongside the vertices of the patch boundary.
+    // Its storage is shared by the thread, so there is a single buffer at a time on each thread
+    Quads& m;
+    std::vector<vec3>& points;
+    std::vector<int>& quads;
+
+    RemeshBuffer(Quads& m) : m(m), points(remeshPoints), quads(remeshQuads) {
+        points.clear();
+        quads.clear();
+    }
+
+    int nverts() const {
+        return m.nverts() + (int)points.size();
+    }
+
+    int createPoints(int n){
+        int first = nverts();
+        points.resize(points.size() + n);
+        return first;
+    }
+
+    vec3& pos(int v){
+        return v < m.nverts() ? m.points[v] : points[v - m.nverts()];
+    }
+};
+
+inline void commitRemesh(RemeshBuffer& buffer, FacetStates& fa){
+    // Replacing the facets of the patch by the new quads, in place: the facets of the patch are deactivated and the new quads appended and
+    // connected around it, see replaceFacetsInPlace, so a commit costs the size of the patch. The main loop compacts the mesh once, at its
+    // end or before it reorders it
+    ScopedTimer timer("commitRemesh");
+    if (profiler.tracing)
+        timer.args = "{\"points\": " + std::to_string(buffer.points.size()) + ", \"quads\": " + std::to_string(buffer.quads.size()/4) + "}";
+    Quads& m = buffer.m;
+    std::vector<int> killed;
+    forEachNonZero(fa, [&](int f, int){
+        killed.push_back(f);
+        return true;
+    });
+
+    if (animationLog != nullptr){
+        // the log is replayed with replaceFacets, which compacts the mesh at each frame, so the frame has the ids of the compacted mesh
+        std::vector<int> facetIds, vertexIds;
+        int nbFacets, nbVertices;
+        compactedIds(m, facetIds, vertexIds, nbFacets, nbVertices);
+        std::vector<bool> toKill(nbFacets, false);
+        for (int f : killed)
+            toKill[facetIds[f]] = true;
+        std::vector<int> quads = buffer.quads;
+        for (int& v : quads)
+            v = v < m.nverts() ? vertexIds[v] : nbVertices + v - m.nverts();
+        animationLog->remesh(toKill, buffer.points, quads);
+    }
+
+    replaceFacetsInPlace(m, killed, buffer.points, buffer.quads);
+}
+
+template <bool reversed>
+inline void meshingGrid(const std::vector<int>& anodes, const std::vector<int>& bnodes, const std::vector<int>& cnodes, const std::vector<int>& dnodes, RemeshBuffer& buffer, BVH& bvh){
+    int a = anodes.size();
+    int b = bnodes.size();
+
+    // Vertex ids of the whole rectangle, line i going from anodes[i] to cnodes[i]. The first line is dnodes and the last one bnodes
+    std::vector<int> grid(a*b);
+    for (int j=0; j<b; j++){
+        grid[j] = dnodes[j];
+        grid[(a-1)*b + j] = bnodes[j];
+    }
+    for (int i=1; i<a-1; i++){
+        grid[i*b] = anodes[i];
+        grid[i*b + b-1] = cnodes[i];
+    }
+
+    // Creating the new points inside the patch, the last created point being the bottom left one
+    buffer.createPoints((a-2)*(b-2));
+    int nverts = buffer.nverts();
+    for (int i=1; i<a-1; i++){
+        vec3 x0 = buffer.pos(anodes[i]);
+        vec3 x1 = buffer.pos(cnodes[i]);
+        for (int j=1; j<b-1; j++){
+            int newPointIndex = nverts - ((i-1)*(b-2) + j);
+            grid[i*b + j] = newPointIndex;
+            buffer.pos(newPointIndex) = bvh.project(x0 + j*(x1-x0)/ (b-1));
+        }
+    }
+
+    // Facets have an orientation, so when the rectangle has been transposed they are built the other way round
+    int offset = buffer.quads.size();
+    buffer.quads.resize(offset + 4*(a-1)*(b-1));
+    int* quad = buffer.quads.data() + offset;
+    for (int i=1; i<a; i++){
+        const int* line = grid.data() + i*b;
+        const int* btmLine = line - b;
+        for (int j=1; j<b; j++){
+            if constexpr (reversed){
+                quad[0] = btmLine[j-1];
+                quad[1] = btmLine[j];
+                quad[2] = line[j];
+                quad[3] = line[j-1];
+            } else {
+                quad[0] = line[j-1];
+                quad[1] = line[j];
+                quad[2] = btmLine[j];
+                quad[3] = btmLine[j-1];
+            }
+            quad += 4;
         }
     }
-    m.compact(true); 
 }
 
-inline void meshingRectangle(std::vector<int>& anodes, std::vector<int>& bnodes, std::vector<int>& cnodes, std::vector<int>& dnodes, Quads& m, BVH bvh){
+inline void meshingRectangle(const std::vector<int>& anodes, const std::vector<int>& bnodes, const std::vector<int>& cnodes, const std::vector<int>& dnodes, RemeshBuffer& buffer, BVH& bvh){
     assert(anodes.size() == cnodes.size());
     assert(bnodes.size() == dnodes.size());
 
@@ -53,124 +165,49 @@ inline void meshingRectangle(std::vector<int>& anodes, std::vector<int>& bnodes,
 
     // In the case there's no new point to create, just have to connect the boundary of the rectangle
     if (anodes.size() < 3 && bnodes.size() < 3){
-        m.conn->create_facet({anodes[0], bnodes[0], bnodes[1], cnodes[0]});
+        buffer.quads.insert(buffer.quads.end(), {anodes[0], bnodes[0], bnodes[1], cnodes[0]});
         return;
     }
 
     // If the rectangle is too small, we make the small part be on the columns rather than lines so we just have to deal with 1 case
-    bool reversed = false;
-    if (anodes.size()<3){
-        std::swap(anodes, dnodes);
-        std::swap(cnodes, bnodes);
-        reversed = true;
-    }
-    int a = anodes.size();
-    int b = bnodes.size();
-
-    // Creating the new points inside the patch, starting from the bottob left corner
-    m.points.create_points((a-2)*(b-2));
-    for (int i=1; i<a; i++){
-        for (int j=1; j<b; j++){
-
-            int newPointIndex = 0;
-            int btmNewPointIndex = 0;
-            if (b<3){
-                newPointIndex = cnodes[i];
-                btmNewPointIndex = cnodes[i-1];
-            }
-            else{
-                vec3 x0 = Vertex(m, anodes[i]).pos();
-                vec3 x1 = Vertex(m, cnodes[i]).pos();
-
-                vec3 newPoint = x0 + j*(x1-x0)/ (b-1); 
-
-                newPointIndex = m.nverts()-  ((i-1)*(b-2) + j);
-                btmNewPointIndex = newPointIndex + (b-2); 
-                if (i<a-1 && j<b-1)
-                    m.points[newPointIndex] = bvh.project(newPoint);
-            }
-
-            // Creating the facets with the new points. facets have an orientation so have a case where we reverse the order of the nodes to adjust
-            if (reversed){
-                if (i==1 && j==1)
-                    m.conn->create_facet({dnodes[0], dnodes[1], newPointIndex, anodes[1]});
-                else if (i==1 && j<b-1)
-                    m.conn->create_facet({dnodes[j-1], dnodes[j], newPointIndex, newPointIndex+1});
-                else if (i==1 && j==b-1)
-                    m.conn->create_facet({dnodes[j-1], dnodes[j], cnodes[i], newPointIndex+1});
-                else if (i<a-1 && j==1)
-                    m.conn->create_facet({anodes[i-1], btmNewPointIndex, newPointIndex, anodes[i]});
-                else if (i<a-1 && j<b-1)
-                    m.conn->create_facet({btmNewPointIndex+1, btmNewPointIndex, newPointIndex, newPointIndex+1});
-                else if (i<a-1 && j==b-1)
-                    m.conn->create_facet({btmNewPointIndex+1, cnodes[i-1], cnodes[i], newPointIndex+1});
-                else if (i==a-1 && j==1)
-                    m.conn->create_facet({anodes[a-2], btmNewPointIndex, bnodes[1], bnodes[0]});
-                else if (i==a-1 && j<b-1)
-                    m.conn->create_facet({btmNewPointIndex+1, btmNewPointIndex, bnodes[j], bnodes[j-1]});
-                else if (i==a-1 && j==b-1)
-                    m.conn->create_facet({btmNewPointIndex+1, cnodes[a-2], cnodes[a-1], bnodes[b-2]});
-            } else {
-                if (i==1 && j==1)
-                    m.conn->create_facet({anodes[1], newPointIndex, dnodes[1], dnodes[0]});
-                else if (i==1 && j<b-1)
-                    m.conn->create_facet({newPointIndex+1, newPointIndex, dnodes[j], dnodes[j-1]});
-                else if (i==1 && j==b-1)
-                    m.conn->create_facet({newPointIndex+1, cnodes[i], dnodes[j], dnodes[j-1]});
-                else if (i<a-1 && j==1)
-                    m.conn->create_facet({anodes[i], newPointIndex, btmNewPointIndex, anodes[i-1]});
-                else if (i<a-1 && j<b-1)
-                 m.conn->create_facet({newPointIndex+1, newPointIndex, btmNewPointIndex, btmNewPointIndex+1});
-                else if (i<a-1 && j==b-1)
-                  m.conn->create_facet({newPointIndex+1, cnodes[i], cnodes[i-1], btmNewPointIndex+1});
-                else if (i==a-1 && j==1)
-                   m.conn->create_facet({bnodes[0], bnodes[1], btmNewPointIndex, anodes[a-2]});
-                else if (i==a-1 && j<b-1)
-                    m.conn->create_facet({bnodes[j-1], bnodes[j], btmNewPointIndex, btmNewPointIndex+1});
-                else if (i==a-1 && j==b-1)
-                    m.conn->create_facet({bnodes[b-2], cnodes[a-1], cnodes[a-2], btmNewPointIndex+1});
-            }
-        }
-    }
-    if (reversed == true){
-        std::swap(anodes, dnodes);
-        std::swap(cnodes, bnodes);
-    }
+    if (anodes.size() < 3)
+        meshingGrid<true>(dnodes, cnodes, bnodes, anodes, buffer, bvh);
+    else
+        meshingGrid<false>(anodes, bnodes, cnodes, dnodes, buffer, bvh);
 }
 
-inline void constructBarycentre(int size, std::vector<std::vector<int>>& anodesList, Quads& m, BVH bvh, vec3& barycentrePos, int& barycentreIndex){
+inline void constructBarycentre(int size, std::vector<std::vector<int>>& anodesList, RemeshBuffer& buffer, BVH& bvh, vec3& barycentrePos, int& barycentreIndex){
    std::vector<int> baryNodes(size, 0);
     for (int i=0;i<size;i++){
         baryNodes[i]=anodesList[i][anodesList[i].size()-1];
-        barycentrePos += Vertex(m, baryNodes[i]).pos();
+        barycentrePos += buffer.pos(baryNodes[i]);
     }
 
     barycentrePos /= size;
     barycentrePos = bvh.project(barycentrePos);
 
-    m.points.create_points(1);
-    barycentreIndex = m.nverts()-1;
-    m.points[barycentreIndex]=barycentrePos;
+    barycentreIndex = buffer.createPoints(1);
+    buffer.pos(barycentreIndex)=barycentrePos;
 }
 
-inline void nPatchRemesh(int* partSegments, std::list<int>& patch, Quads& m, int size, BVH bvh){
-    // We have a 3 or a 5 patch, that we'll divide it in 3 or 5 rectangles to remesh them individually
+inline void nPatchRemesh(int* partSegments, std::vector<int>& boundary, RemeshBuffer& buffer, int size, BVH& bvh){
+    // We have a 3, 5 or 6 patch, that we'll divide it in 3, 5 or 6 rectangles around a single new singularity to remesh them individually
     // each ones will have anodes, bnodes, cnodes, dnodes (see the meshingRectangle function)
 
     // anodes and dnodes, they are on the boundary on the initial patch so we iterate over it
     std::vector<std::vector <int>> anodesList(size);
     std::vector<std::vector <int>> dnodesList(size);
-    auto it = patch.begin();
-    it++;
+    int n = boundary.size();
+    int it = 1;
     for (int i=0;i<size;i++){
         it--;
         for (int j=0;j<partSegments[2*i]+1;j++){
-            anodesList[i].push_back(Halfedge(m, *it).from());
+            anodesList[i].push_back(boundary[it % n]);
             it++;
         }
         it--;
         for (int j=0;j<partSegments[2*i+1]+1;j++){
-            dnodesList[i].push_back(Halfedge(m, *it).from());
+            dnodesList[i].push_back(boundary[it % n]);
             it++;
         }
     }
@@ -183,7 +220,7 @@ inline void nPatchRemesh(int* partSegments, std::list<int>& patch, Quads& m, int
 
     int barycentreIndex = 0;
     vec3 barycentrePos = {0,0,0};
-    constructBarycentre(size, anodesList, m, bvh, barycentrePos, barycentreIndex);
+    constructBarycentre(size, anodesList, buffer, bvh, barycentrePos, barycentreIndex);
 
         
     // b nodes, we're going to create new points between the barycentre and the anodes
@@ -193,16 +230,16 @@ inline void nPatchRemesh(int* partSegments, std::list<int>& patch, Quads& m, int
 
         int x0index = anodesList[i][anodesList[i].size()-1];
         bnodesList[i].push_back(x0index);
-        vec3 x0 = Vertex(m, x0index).pos();
+        vec3 x0 = buffer.pos(x0index);
         vec3 x1 = barycentrePos;
         int bnodesLen = (int)dnodesList[i].size();
 
-        m.points.create_points(bnodesLen-1);
+        buffer.createPoints(bnodesLen-1);
         for (int j=1;j<bnodesLen-1;j++){
             // Make the new point
             vec3 newPoint = x0 +j*(x1-x0) / (bnodesLen-1);
-            int newPointIndex = m.nverts()-j;
-            m.points[newPointIndex] = bvh.project(newPoint);
+            int newPointIndex = buffer.nverts()-j;
+            buffer.pos(newPointIndex) = bvh.project(newPoint);
             bnodesList[i].push_back(newPointIndex);
         }
         bnodesList[i].push_back(barycentreIndex);
@@ -214,31 +251,11 @@ inline void nPatchRemesh(int* partSegments, std::list<int>& patch, Quads& m, int
 
 
     for (int i=0; i<size; i++){
-        meshingRectangle(anodesList[i], bnodesList[i], cnodesList[i], dnodesList[i], m, bvh);
+        meshingRectangle(anodesList[i], bnodesList[i], cnodesList[i], dnodesList[i], buffer, bvh);
     } 
 
 }
 
-inline void segmentConstruction(std::list<int>& patchConvexity, int* segments, int edge){
-    // construct array with the number of points between each edge
-    int n = edge;
-    int edgeLength = 0;
-    int skip = 1;
-    for (int convexity : patchConvexity){
-        if (skip){
-            skip = 0;
-            continue;
-        } 
-        edgeLength++;
-        if (convexity >= 1){
-            segments[n-edge] = edgeLength;
-            edge--;
-            edgeLength = 0;
-        }
-    }
-    segments[n-1] = edgeLength+1;
-}
-
 inline void fillingConvexPos(std::list<int>& patchConvexity, std::vector<int>& convexPos){
     int count = 0;
     int letterToFill = 0;
@@ -307,7 +324,7 @@ inline int roundUpDivide(int a, int b){
 inline bool find(std::list<int>& v, int x){
     return std::find(v.begin(), v.end(), x) != v.end();
 }
-inline void rectanglePatchRemesh(std::list<int>& patch, int* segments, Quads& m, BVH bvh){
+inline void rectanglePatchRemesh(std::list<int>& patch, int* segments, Quads& m, BVH& bvh, RemeshBuffer& buffer){
 
     int aSize = segments[1]+1;
     int bSize = segments[0]+1;
@@ -344,18 +361,18 @@ inline void rectanglePatchRemesh(std::list<int>& patch, int* segments, Quads& m,
         }
         it++;
     }
-    meshingRectangle(anodes, bnodes, cnodes, dnodes, m, bvh);
+    meshingRectangle(anodes, bnodes, cnodes, dnodes, buffer, bvh);
 
 }
 
-inline void createPointsBetween2Vx(std::vector<int>& nodes, int n, Quads& m, BVH bvh){
-    m.points.create_points(n-1);
+inline void createPointsBetween2Vx(std::vector<int>& nodes, int n, RemeshBuffer& buffer, BVH& bvh){
+    buffer.createPoints(n-1);
     for (int i=1; i<n; i++){
-        vec3 x0 = Vertex(m, nodes[0]).pos();
-        vec3 x1 = Vertex(m, nodes[n]).pos();
+        vec3 x0 = buffer.pos(nodes[0]);
+        vec3 x1 = buffer.pos(nodes[n]);
         vec3 newPoint = x0 + i*(x1-x0)/n;
-        nodes[i] = m.nverts()-i;
-        m.points[m.nverts()-i] = bvh.project(newPoint);
+        nodes[i] = buffer.nverts()-i;
+        buffer.pos(buffer.nverts()-i) = bvh.project(newPoint);
     }
 }
 
@@ -393,7 +410,7 @@ inline void ajustPartSegments(int* partSegments, int c, int btm, int a){
     assert(false);
 }
 
-inline void quadrilateralPatchRemesh(int* partSegments, std::list<int>& patch, std::list<int>& patchConvexity, Quads& m, BVH bvh, int a, int b, int c, int d){
+inline void quadrilateralPatchRemesh(int* partSegments, std::list<int>& patch, std::list<int>& patchConvexity, Quads& m, BVH& bvh, int a, int b, int c, int d, RemeshBuffer& buffer){
     //                 bnodes       bnodes2
     //               -------->    -------->
     //             ------------------------
@@ -450,7 +467,7 @@ inline void quadrilateralPatchRemesh(int* partSegments, std::list<int>& patch, s
         std::advance(it, -b/2);
         cnodes[a-1] = Halfedge(m, *it).from();
 
-        createPointsBetween2Vx(cnodes, a-1, m, bvh);
+        createPointsBetween2Vx(cnodes, a-1, buffer, bvh);
         std::reverse(cnodes.begin(), cnodes.end());
 
     // Let's do d nodes now
@@ -464,9 +481,9 @@ inline void quadrilateralPatchRemesh(int* partSegments, std::list<int>& patch, s
         }
 
     if (!wasReversed)
-        meshingRectangle(anodes, bnodes, cnodes, dnodes, m, bvh);
+        meshingRectangle(anodes, bnodes, cnodes, dnodes, buffer, bvh);
     else
-        meshingRectangle(dnodes, cnodes, bnodes, anodes, m, bvh);
+        meshingRectangle(dnodes, cnodes, bnodes, anodes, buffer, bvh);
 
 
 
@@ -482,7 +499,7 @@ inline void quadrilateralPatchRemesh(int* partSegments, std::list<int>& patch, s
         std::advance(it, a+b+c-3+(b-1)/2);
         anodes2[c-1] = Halfedge(m, *it).from();
 
-        createPointsBetween2Vx(anodes2, c-1, m, bvh);
+        createPointsBetween2Vx(anodes2, c-1, buffer, bvh);
         std::reverse(anodes2.begin(), anodes2.end());
 
         // b nodes
@@ -513,9 +530,9 @@ inline void quadrilateralPatchRemesh(int* partSegments, std::list<int>& patch, s
         std::reverse(dnodes2.begin(), dnodes2.end());
 
         if (!wasReversed)
-            meshingRectangle(anodes2, bnodes2, cnodes2, dnodes2, m, bvh);
+            meshingRectangle(anodes2, bnodes2, cnodes2, dnodes2, buffer, bvh);
         else
-            meshingRectangle(dnodes2, cnodes2, bnodes2, anodes2, m, bvh);
+            meshingRectangle(dnodes2, cnodes2, bnodes2, anodes2, buffer, bvh);
 
     } else {
 
@@ -539,76 +556,219 @@ inline void quadrilateralPatchRemesh(int* partSegments, std::list<int>& patch, s
         it++;
     }
 
-    std::list<int> lst;
+    std::vector<int> lst;
     std::reverse(anodes2.begin(), anodes2.end());
     lst.insert(lst.end(), anodes2.begin(), anodes2.end()-1);
     lst.insert(lst.end(), btmPart.begin(), btmPart.end()-1);
     lst.insert(lst.end(), cnodes.begin(), cnodes.end()-1);
 
-
-    // Converting the vertices to halfedges for the nPatchRemesh function
-    for (auto it = lst.begin(); it != lst.end(); ++it) {
-        assert(Vertex(m, *it).halfedge().from() == Vertex(m, *it));
-        *it = Vertex(m, *it).halfedge();
-    }
-
     if (wasReversed){
         std::reverse(partSegments, partSegments + 6);
         std::reverse(std::next(lst.begin()), lst.end());
     }
 
     ajustPartSegments(partSegments, a-1, d-b, c-1);
-    nPatchRemesh(partSegments, lst, m, 3, bvh);
+    nPatchRemesh(partSegments, lst, buffer, 3, bvh);
+}
+
+inline std::vector<int> patchVertices(std::list<int>& patch, Quads& m){
+    std::vector<int> boundary;
+    boundary.reserve(patch.size());
+    for (int he : patch)
+        boundary.push_back(Halfedge(m, he).from());
+    return boundary;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Checking a remesh before committing it
+
+inline std::vector<int> flattenHexagonPatch(int* partSegments, std::vector<int>& segments, std::list<int>& patch, std::list<int>& patchConvexity){
+    // A hexagon with the parts ak and a(k+3) of 0, see solve6equations: its corners k and k+3 are no longer corners, and the patch is rotated
+    // to start on a corner of the quadrilateral. Returns the sides of the quadrilateral
+    int k = partSegments[0] == 0 ? 0 : partSegments[2] == 0 ? 1 : 2;
+    std::vector<int> quadSegments(4);
+    int start = flattenHexagon(segments.data(), k, quadSegments.data());
+
+    int position = 0;
+    int startPosition = 0;
+    auto convexity = patchConvexity.begin();
+    for (int corner = 0; corner < 6; corner++){
+        if (corner == start)
+            startPosition = position;
+        if (corner % 3 == k)
+            *convexity = 0;
+        std::advance(convexity, segments[corner]);
+        position += segments[corner];
+    }
+    for (int i = 0; i < startPosition; i++){
+        patch.splice(patch.end(), patch, patch.begin());
+        patchConvexity.splice(patchConvexity.end(), patchConvexity, patchConvexity.begin());
+    }
+    return quadSegments;
+}
+
+inline vec3 quadNormal(const vec3& a, const vec3& b, const vec3& c, const vec3& d){
+    return cross(c - a, d - b);
+}
+
+inline bool hasInvertedQuads(RemeshBuffer& buffer, BVH& bvh){
+    // A new quad must face the same side as the input surface under it
+    for (int q=0; q<(int)buffer.quads.size()/4; q++){
+        const int* quad = buffer.quads.data() + 4*q;
+        vec3 x0 = buffer.pos(quad[0]);
+        vec3 x1 = buffer.pos(quad[1]);
+        vec3 x2 = buffer.pos(quad[2]);
+        vec3 x3 = buffer.pos(quad[3]);
+
+        int facet = -1;
+        bvh.project((x0 + x1 + x2 + x3)/4, facet);
+        if (facet != -1 && quadNormal(x0, x1, x2, x3)*bvh.facet_normal(facet) <= 0)
+            return true;
+    }
+
+    return false;
+}
+
+template <typename Cost>
+inline std::pair<int, int> patchValenceCost(RemeshBuffer& buffer, FacetStates& fa, Cost cost){
+    // The sum of the cost of the valences of the vertices of the patch, boundary included, before and after the remesh
+    Quads& m = buffer.m;
+
+    std::vector<int> oldVertices;
+    forEachNonZero(fa, [&](int f, int){
+        for (int i=0; i<4; i++)
+            oldVertices.push_back(m.vert(f, i));
+        return true;
+    });
+    std::sort(oldVertices.begin(), oldVertices.end());
+    oldVertices.erase(std::unique(oldVertices.begin(), oldVertices.end()), oldVertices.end());
+
+    int before = 0;
+    for (int v : oldVertices)
+        before += cost(getValence(Vertex(m, v)));
+
+    // the valence of a vertex after the remesh is its number of new quads, plus the facets it keeps outside of the patch
+    std::vector<int> newVertices = buffer.quads;
+    std::sort(newVertices.begin(), newVertices.end());
+
+    int after = 0;
+    for (int i=0; i<(int)newVertices.size();){
+        int v = newVertices[i];
+        int valence = 0;
+        for (; i<(int)newVertices.size() && newVertices[i] == v; i++)
+            valence++;
+
+        if (v < m.nverts()){
+            Halfedge he = Vertex(m, v).halfedge();
+            for (int j=0; j<MAX_VALENCE; j++){
+                if (fa[he.facet()] < 1)
+                    valence++;
+                // a vertex on a border is left as it is, as getValence does
+                if (he.opposite() == -1){
+                    valence = 4;
+                    break;
+                }
+                he = he.opposite().next();
+                if (he == Vertex(m, v).halfedge())
+                    break;
+            }
+        }
+        after += cost(valence);
+    }
+
+    return {before, after};
+}
+
+inline bool hasWorseValence(RemeshBuffer& buffer, FacetStates& fa){
+    // The irregularity of the vertices of the patch must not grow with the remesh
+    auto [before, after] = patchValenceCost(buffer, fa, [](int valence){ return std::abs(valence - 4); });
+    return after > before;
+}
+
+inline bool hasMoreDefects(RemeshBuffer& buffer, FacetStates& fa){
+    // The remesh must not leave more defects on the vertices of the patch than it removes
+    auto [before, after] = patchValenceCost(buffer, fa, [](int valence){ return int(valence != 4); });
+    return after > before;
 }
 
-inline bool remeshingPatch(std::list<int>& patch, std::list<int>& patchConvexity, int nEdge, Quads& m, FacetAttribute<int>& fa, int v, BVH bvh){
+inline bool remeshingPatch(std::list<int>& patch, std::list<int>& patchConvexity, std::vector<int>& segments, Quads& m, FacetStates& fa, int v, BVH& bvh, bool REJECT_INVERTED = false, bool REJECT_WORSE_VALENCE = false){
+    int nEdge = segments.size();
     assert(patchConvexity.front() >= 1);
-    assert(nEdge == 3 || nEdge == 5 || nEdge == 4);
+    assert(nEdge == 3 || nEdge == 5 || nEdge == 4 || nEdge == 6);
 
-    // Segments contains the number of points between each edge of the patch
+    // Segments contains the number of points between each edge of the patch, it is kept up to date by the patch expansion
     // PartSegments are the segments but divided in 2 parts, according to the results of Bunin's equations
-    int segments[] = {0,0,0,0,0};
-    int partSegments[] = {0,0,0,0,0,0,0,0,0,0};
-    segmentConstruction(patchConvexity, segments, nEdge);
+    int partSegments[] = {0,0,0,0,0,0,0,0,0,0,0,0};
+
+    // The new points and quads are only added to the mesh once the whole patch has been remeshed and checked
+    RemeshBuffer buffer(m);
+    std::string solved;
+    ScopedTimer kernelTimer("remesh kernel"); // building the new quads, with the projections of the new points
 
     int a = 0;
     int b = 0;
     int c = 0;
     int d = 0;
     int solve4equationsCase = 0;
+    int solve6equationsCase = nEdge == 6 ? solve6equations(segments.data(), partSegments) : 0;
 
     if (nEdge == 4){
-        solve4equationsCase = solve4equations(segments, partSegments, a, b, c, d);
+        solve4equationsCase = solve4equations(segments.data(), partSegments, a, b, c, d);
         if (solve4equationsCase == 1){
-            rectanglePatchRemesh(patch, segments, m, bvh);
-            cleaningTopology(m, fa);
-            std::cout << "solve " << nEdge << " (rectangle) equations success,    root: " << v << std::endl;
-            return true;
+            rectanglePatchRemesh(patch, segments.data(), m, bvh, buffer);
+            solved = "solve 4 (rectangle) equations success,    root: ";
+
+        } else if (solve4equationsCase == 2){
+            // the patch is rotated to its bottom left corner, a copy is used so that a rejected remesh leaves it as it was
+            std::list<int> rotatedPatch = patch;
+            std::list<int> rotatedConvexity = patchConvexity;
+            quadrilateralPatchRemesh(partSegments, rotatedPatch, rotatedConvexity, m, bvh, a, b, c, d, buffer);
+            solved = "solve 4 (nonRectangle) equations success, root: ";
         }
 
-        if (solve4equationsCase == 2){
-            quadrilateralPatchRemesh(partSegments, patch, patchConvexity, m, bvh, a, b, c, d);
-            cleaningTopology(m, fa);
-            std::cout << "solve " << nEdge << " (nonRectangle) equations success, root: " << v << std::endl;
-            return true;
+    } else if (solve6equationsCase == 2){
+        // the corners of the hexagon on the sides of the quadrilateral it degenerates to are flattened, on copies of the patch
+        std::list<int> rotatedPatch = patch;
+        std::list<int> rotatedConvexity = patchConvexity;
+        std::vector<int> quadSegments = flattenHexagonPatch(partSegments, segments, rotatedPatch, rotatedConvexity);
+        solve4equationsCase = solve4equations(quadSegments.data(), partSegments, a, b, c, d);
+        if (solve4equationsCase == 1){
+            rectanglePatchRemesh(rotatedPatch, quadSegments.data(), m, bvh, buffer);
+            solved = "solve 6 (rectangle) equations success,    root: ";
+        } else if (solve4equationsCase == 2){
+            quadrilateralPatchRemesh(partSegments, rotatedPatch, rotatedConvexity, m, bvh, a, b, c, d, buffer);
+            solved = "solve 6 (nonRectangle) equations success, root: ";
         }
 
-    } else if (nEdge == 3){
-        if (solve3equations(segments, partSegments)){
-            nPatchRemesh(partSegments, patch, m, nEdge, bvh);
-            cleaningTopology(m, fa);
-            std::cout << "solve " << nEdge << " equations success,                root: " << v << std::endl;
-            return true;
-        }
+    } else if ((nEdge == 3 && solve3equations(segments.data(), partSegments)) ||
+               (nEdge == 5 && solve5equations(segments.data(), partSegments)) ||
+               solve6equationsCase == 1){
+        std::vector<int> boundary = patchVertices(patch, m);
+        nPatchRemesh(partSegments, boundary, buffer, nEdge, bvh);
+        solved = "solve " + std::to_string(nEdge) + " equations success,                root: ";
+    }
 
-    } else if (nEdge == 5){
-        if (solve5equations(segments, partSegments)){
-            nPatchRemesh(partSegments, patch, m, nEdge, bvh);
-            cleaningTopology(m, fa);
-            std::cout << "solve " << nEdge << " equations success,                root: " << v << std::endl;
-            return true;
-        }
+    kernelTimer.stop();
+    if (solved.empty())
+        return false;
+
+    // Straight interpolation inside a curved patch often folds a few quads, which a smoothing can recover, so they are only rejected on demand
+    ScopedTimer checkTimer("remesh checks");
+    // A hexagon always gets a valence 6 vertex at its centre, and its corners turning by more than a quad keep their defects: the
+    // patch may have had less of them
+    bool rejected = (nEdge == 6 && hasMoreDefects(buffer, fa)) || (REJECT_WORSE_VALENCE && hasWorseValence(buffer, fa)) || (REJECT_INVERTED && hasInvertedQuads(buffer, bvh));
+    checkTimer.stop();
+    if (rejected){
+        profiler.count("remeshes rejected");
+        if (verbose)
+            std::cout << "remesh rejected,                          root: " << v << std::endl;
+        return false;
     }
 
-    return false;
+    profiler.structure("RemeshBuffer", buffer.points.capacity()*sizeof(vec3) + buffer.quads.capacity()*sizeof(int));
+    commitRemesh(buffer, fa);
+    profiler.count("remeshes");
+    if (verbose)
+        std::cout << solved << v << std::endl;
+    return true;
 }
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <ultimaille/all.h>
+#include "packedAttributes.h"
+
+using namespace UM;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reordering
+//
+// The facets are sorted along a space filling curve going through their centroids, and the vertices numbered in the order the facets use
+// them, so the facets and vertices close on the surface are close in memory too, which the walks around the vertices and the patches benefit from
+
+enum class CurveOrder { none, morton, hilbert };
+
+inline uint64_t mortonKey(const uint32_t x[3], int bits){
+    uint64_t key = 0;
+    for (int b = bits-1; b >= 0; b--)
+        for (int i = 0; i < 3; i++)
+            key = (key << 1) | ((x[i] >> b) & 1);
+    return key;
+}
+
+inline uint64_t hilbertKey(uint32_t x[3], int bits){
+    // Skilling, "Programming the Hilbert curve" (2004): the coordinates are turned into the transposed Hilbert index, whose bits are then
+    // interleaved as for the Morton order
+    for (uint32_t q = 1u << (bits-1); q > 1; q >>= 1){
+        uint32_t p = q - 1;
+        for (int i = 0; i < 3; i++){
+            if (x[i] & q){
+                x[0] ^= p;
+            } else {
+                uint32_t t = (x[0] ^ x[i]) & p;
+                x[0] ^= t;
+                x[i] ^= t;
+            }
+        }
+    }
+    for (int i = 1; i < 3; i++)
+        x[i] ^= x[i-1];
+    uint32_t t = 0;
+    for (uint32_t q = 1u << (bits-1); q > 1; q >>= 1)
+        if (x[2] & q)
+            t ^= q - 1;
+    for (int i = 0; i < 3; i++)
+        x[i] ^= t;
+    return mortonKey(x, bits);
+}
+
+template <class T>
+inline void permute(std::vector<T>& data, const std::vector<int>& order, int stride){
+    // data[i] becomes data[order[i]], by blocks of stride values
+    std::vector<T> permuted(data.size());
+    for (int i = 0; i < (int)order.size(); i++)
+        for (int j = 0; j < stride; j++)
+            permuted[stride*i + j] = data[stride*order[i] + j];
+    data.swap(permuted);
+}
+
+template <class F>
+inline bool withValues(GenericAttributeContainer& container, F f){
+    // Calls f on the values of an attribute bound to the mesh, for the types of the attributes of the library and of ultimaille it is used
+    // with. False for any other type, as the containers can only be resized and compressed through their base
+    if (auto values = dynamic_cast<AttributeContainer<int>*>(&container))
+        f(values->data);
+    else if (auto values = dynamic_cast<AttributeContainer<double>*>(&container))
+        f(values->data);
+    else if (auto values = dynamic_cast<AttributeContainer<bool>*>(&container))
+        f(values->data);
+    else if (auto values = dynamic_cast<AttributeContainer<vec3>*>(&container))
+        f(values->data);
+    else if (auto values = dynamic_cast<PackedContainer<1>*>(&container))
+        f(*values);
+    else if (auto values = dynamic_cast<PackedContainer<2>*>(&container))
+        f(*values);
+    else
+        return false;
+    return true;
+}
+
+template <class List>
+inline bool canPermute(List& attributes){
+    for (auto& attribute : attributes)
+        if (auto container = attribute.lock(); container && !withValues(*container, [](auto&){}))
+            return false;
+    return true;
+}
+
+template <class List>
+inline void permuteAll(List& attributes, const std::vector<int>& order, int stride){
+    // the attributes destroyed since are skipped
+    for (auto& attribute : attributes)
+        if (auto container = attribute.lock())
+            withValues(*container, [&](auto& values){ permute(values, order, stride); });
+}
+
+inline bool reorder(Quads& m, CurveOrder curve){
+    // The attributes bound to the mesh follow their facets, corners and vertices. False if the mesh is left as it is, as when one of its
+    // attributes is of a type withValues doesn't know
+    if (curve == CurveOrder::none || m.nfacets() == 0)
+        return false;
+    if (!canPermute(m.attr_facets) || !canPermute(m.attr_corners) || !canPermute(m.points.attr))
+        return false;
+    bool connected = (bool)m.conn;
+    if (connected)
+        m.disconnect();
+
+    vec3 min = m.points[0];
+    vec3 max = m.points[0];
+    for (int v = 0; v < m.nverts(); v++)
+        for (int i = 0; i < 3; i++){
+            min[i] = std::min(min[i], m.points[v][i]);
+            max[i] = std::max(max[i], m.points[v][i]);
+        }
+
+    // 21 bits per coordinate, as the 3 fit in the 64 bits of the key
+    const int bits = 21;
+    std::vector<std::pair<uint64_t, int>> keys(m.nfacets());
+    #pragma omp parallel for
+    for (int f = 0; f < m.nfacets(); f++){
+        vec3 centroid = {0, 0, 0};
+        for (int i = 0; i < 4; i++)
+            centroid += m.points[m.vert(f, i)] / 4;
+        uint32_t x[3];
+        for (int i = 0; i < 3; i++){
+            double extent = max[i] - min[i];
+            double t = extent > 0 ? (centroid[i] - min[i]) / extent : 0;
+            x[i] = std::min<uint32_t>((1u << bits) - 1, t * (1u << bits));
+        }
+        keys[f] = {curve == CurveOrder::hilbert ? hilbertKey(x, bits) : mortonKey(x, bits), f};
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<int> facetOrder(m.nfacets());
+    for (int i = 0; i < m.nfacets(); i++)
+        facetOrder[i] = keys[i].second;
+    permute(m.facets, facetOrder, 4);
+    permuteAll(m.attr_facets, facetOrder, 1);
+    permuteAll(m.attr_corners, facetOrder, 4);
+
+    // the vertices by first use, the isolated ones at the end
+    std::vector<int> newId(m.nverts(), -1);
+    std::vector<int> vertexOrder;
+    vertexOrder.reserve(m.nverts());
+    for (int& v : m.facets){
+        if (newId[v] == -1){
+            newId[v] = vertexOrder.size();
+            vertexOrder.push_back(v);
+        }
+        v = newId[v];
+    }
+    for (int v = 0; v < m.nverts(); v++)
+        if (newId[v] == -1)
+            vertexOrder.push_back(v);
+
+    std::vector<vec3> points(m.nverts());
+    for (int v = 0; v < m.nverts(); v++)
+        points[v] = m.points[vertexOrder[v]];
+    for (int v = 0; v < m.nverts(); v++)
+        m.points[v] = points[v];
+    permuteAll(m.points.attr, vertexOrder, 1);
+
+    if (connected)
+        m.connect();
+    return true;
+}
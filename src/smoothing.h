@@ -0,0 +1,76 @@
+#pragma once
+
+#include <iostream>
+#include <ultimaille/all.h>
+#include <vector>
+#include "bvh.h"
+#include "patchFinding.h"
+#include "profiling.h"
+
+using namespace UM;
+using Halfedge = typename Surface::Halfedge;
+using Facet = typename Surface::Facet;
+using Vertex = typename Surface::Vertex;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Smoothing
+
+inline bool isMovable(Vertex v, FacetFlags& region, CornerFlags& ca){
+    // A vertex is only moved if all its facets are in the region, and if it is neither on the border of the mesh nor on a hard edge
+    Halfedge he = v.halfedge();
+    for (int i = 0; i < MAX_VALENCE; i++){
+        if (region[he.facet()] == 0 || he.opposite() == -1 || ca[he] == 1 || ca[he.opposite()] == 1)
+            return false;
+
+        he = he.opposite().next();
+        if (he == v.halfedge())
+            return true;
+    }
+
+    return false;
+}
+
+inline void smoothing(Quads& m, BVH& bvh, FacetFlags& region, CornerFlags& ca, int nbIterations){
+    // Tangential relaxation: each vertex moves toward the barycentre of its neighbours, in its tangent plane, then is projected back on the input surface.
+    // The new positions only depend on the ones of the previous iteration, so all the vertices are moved in parallel
+    std::vector<int> movable;
+    for (Vertex v : m.iter_vertices())
+        if (isMovable(v, region, ca))
+            movable.push_back(v);
+
+    std::vector<vec3> newPos(movable.size());
+    for (int it = 0; it < nbIterations; it++){
+        ScopedTimer timer("smoothing iteration");
+
+        #pragma omp parallel for
+        for (int i = 0; i < (int)movable.size(); i++){
+            Vertex v(m, movable[i]);
+            vec3 barycentre = {0,0,0};
+            vec3 normal = {0,0,0};
+            int valence = 0;
+
+            Halfedge he = v.halfedge();
+            for (int j = 0; j < MAX_VALENCE; j++){
+                barycentre += he.to().pos();
+                normal += he.facet().geom<Quad3>().normal();
+                valence++;
+
+                he = he.opposite().next();
+                if (he == v.halfedge())
+                    break;
+            }
+            barycentre /= valence;
+            normal.normalize();
+
+            vec3 move = barycentre - v.pos();
+            move -= (move*normal)*normal;
+            newPos[i] = bvh.project(v.pos() + move);
+        }
+
+        for (int i = 0; i < (int)movable.size(); i++)
+            m.points[movable[i]] = newPos[i];
+    }
+
+    if (verbose)
+        std::cout << "Smoothed " << movable.size() << " vertices, " << nbIterations << " iterations" << std::endl;
+}
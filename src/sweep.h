@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <ultimaille/all.h>
+#include "batch.h"
+#include "bunin.h"
+#include "profiling.h"
+
+using namespace UM;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Parameter sweep
+
+inline std::string seedingName(bunin::Seeding seeding){
+    return seeding == bunin::Seeding::BreadthFirst ? "bfs" : "field";
+}
+
+inline std::string orderName(bunin::Order order){
+    return order == bunin::Order::Morton ? "morton" : order == bunin::Order::Hilbert ? "hilbert" : "input";
+}
+
+struct SweepRun {
+    bunin::Options options;
+    std::string status = "not run";  // "ok", "stopped: " and the reason, or what went wrong
+    bunin::Result result;
+
+    std::string name() const {
+        return "maxPatchSize=" + std::to_string(options.maxPatchSize) + " cad_mode=" + (options.cadMode ? "true" : "false")
+             + " edge_flipping=" + (options.edgeFlipping ? "true" : "false") + " reject_inverted=" + (options.rejectInverted ? "true" : "false")
+             + " seeding=" + seedingName(options.seeding) + " order=" + orderName(options.order) + " smooth_iterations=" + std::to_string(options.smoothIterations);
+    }
+    bool failed() const { return status != "ok" && status.rfind("stopped", 0) != 0; }
+};
+
+struct SweepMesh {
+    // A copy of the input mesh with the attributes written with it
+    Quads m;
+    FacetAttribute<int> patch{m, 0};
+    CornerAttribute<int> hardEdges{m, 0};
+};
+
+inline bool setSweepValue(bunin::Options& options, const std::string& key, const std::string& value){
+    // Sets the swept parameter key of options to value, as main reads it
+    if (key == "maxPatchSize" || key == "smooth_iterations"){
+        int number;
+        try {
+            number = std::stoi(value);
+        } catch (std::exception&) {
+            std::cerr << "Error: " << value << " is not a number for " << key << std::endl;
+            return false;
+        }
+        (key == "maxPatchSize" ? options.maxPatchSize : options.smoothIterations) = number;
+    } else if (key == "cad_mode" || key == "edge_flipping" || key == "reject_inverted"){
+        if (value != "true" && value != "false"){
+            std::cerr << "Error: " << key << " is either true or false, not " << value << std::endl;
+            return false;
+        }
+        (key == "cad_mode" ? options.cadMode : key == "edge_flipping" ? options.edgeFlipping : options.rejectInverted) = value == "true";
+    } else if (key == "seeding"){
+        if (value != "field" && value != "bfs"){
+            std::cerr << "Error: seeding is either field or bfs, not " << value << std::endl;
+            return false;
+        }
+        options.seeding = value == "bfs" ? bunin::Seeding::BreadthFirst : bunin::Seeding::NearestDefects;
+    } else if (key == "order"){
+        if (value != "input" && value != "morton" && value != "hilbert"){
+            std::cerr << "Error: order is either input, morton or hilbert, not " << value << std::endl;
+            return false;
+        }
+        options.order = value == "hilbert" ? bunin::Order::Hilbert : value == "morton" ? bunin::Order::Morton : bunin::Order::Input;
+    }
+    return true;
+}
+
+inline bool sweepRuns(const std::string& sweep, const bunin::Options& base, std::vector<SweepRun>& runs){
+    // sweep lists the values of each swept parameter, as "maxPatchSize:100,300,500;cad_mode:false,true;seeding:field,bfs".
+    // Every combination of them is run, the parameters not given keeping their value of base
+    const std::vector<std::string> keys = {"maxPatchSize", "cad_mode", "edge_flipping", "reject_inverted", "seeding", "order", "smooth_iterations"};
+    std::vector<std::vector<std::string>> sweptValues(keys.size());
+
+    std::stringstream parameters(sweep);
+    std::string parameter;
+    while (std::getline(parameters, parameter, ';')){
+        if (parameter.empty())
+            continue;
+        size_t colon = parameter.find(':');
+        if (colon == std::string::npos){
+            std::cerr << "Error: " << parameter << " has no values in the sweep" << std::endl;
+            return false;
+        }
+        std::string key = parameter.substr(0, colon);
+        auto swept = std::find(keys.begin(), keys.end(), key);
+        if (swept == keys.end()){
+            std::cerr << "Error: " << key << " can't be swept, only maxPatchSize, cad_mode, edge_flipping, reject_inverted, seeding, order and smooth_iterations can" << std::endl;
+            return false;
+        }
+
+        std::vector<std::string> values;
+        std::stringstream list(parameter.substr(colon + 1));
+        std::string value;
+        while (std::getline(list, value, ',')){
+            bunin::Options checked = base;
+            if (!setSweepValue(checked, key, value))
+                return false;
+            values.push_back(value);
+        }
+        if (values.empty()){
+            std::cerr << "Error: " << key << " has no values in the sweep" << std::endl;
+            return false;
+        }
+        sweptValues[swept - keys.begin()] = values;
+    }
+
+    // the first parameters vary the slowest
+    runs.assign(1, SweepRun());
+    runs[0].options = base;
+    for (int k = 0; k < (int)keys.size(); k++){
+        if (sweptValues[k].empty())
+            continue;
+        std::vector<SweepRun> combined;
+        for (const SweepRun& run : runs)
+            for (const std::string& value : sweptValues[k]){
+                combined.push_back(run);
+                setSweepValue(combined.back().options, keys[k], value);
+            }
+        runs.swap(combined);
+    }
+    return true;
+}
+
+inline bool betterRun(const SweepRun& a, const SweepRun& b){
+    // The one leaving the less defects, then the fastest one
+    if (a.result.defectsAfter != b.result.defectsAfter)
+        return a.result.defectsAfter < b.result.defectsAfter;
+    return a.result.seconds < b.result.seconds;
+}
+
+inline int runSweep(Quads& m, std::vector<SweepRun>& runs, int nbThreads, std::unique_ptr<SweepMesh>& best){
+    // The mesh is loaded and its projection structure built once, each run remeshing its own copy of the mesh, as the remeshing changes all of it.
+    // Only the copy of the best run so far is kept, so there are at most as many copies as threads, plus this one. Returns the index of the best run, -1 if none succeeded
+    bunin::Projection projection(m);
+
+    int bestRun = -1;
+    int done = 0;
+    std::mutex bestMutex;
+    runJobs(runs.size(), nbThreads, [&](int i){
+        SweepRun& run = runs[i];
+        if (run.options.cancel != nullptr && *run.options.cancel){
+            run.status = "cancelled";
+            return;
+        }
+
+        run.options.threads = 1;
+        run.options.verbose = false;
+        run.options.animationPath.clear();
+        auto copy = std::make_unique<SweepMesh>();
+        try {
+            bunin::copy(m, copy->m);
+            run.result = bunin::remesh(copy->m, projection, run.options, copy->patch, copy->hardEdges);
+            run.status = run.result.stopped.empty() ? "ok" : "stopped: " + run.result.stopped;
+        } catch (std::exception& e) {
+            run.status = std::string("error: ") + e.what();
+        }
+
+        std::lock_guard<std::mutex> lock(bestMutex);
+        if (!run.failed() && (bestRun == -1 || betterRun(run, runs[bestRun]))){
+            bestRun = i;
+            best = std::move(copy);
+        }
+        std::cout << "[" << ++done << "/" << runs.size() << "] " << run.name() << ": " << run.status << ", "
+                  << run.result.defectsBefore - run.result.defectsAfter << " out of " << run.result.defectsBefore << " defects corrected in "
+                  << std::fixed << std::setprecision(2) << run.result.seconds << "s" << std::defaultfloat << std::endl;
+    });
+
+    return bestRun;
+}
+
+inline bool writeSweepResults(const std::string& path, const std::string& model, const std::vector<SweepRun>& runs, int bestRun, double seconds){
+    std::ofstream out(path);
+    if (!out.is_open())
+        return false;
+
+    out << std::setprecision(9);
+    out << "{\n";
+    out << "  \"model\": \"" << Profiler::escape(model) << "\",\n";
+    out << "  \"seconds\": " << seconds << ",\n";
+    out << "  \"best\": " << bestRun << ",\n";
+    out << "  \"runs\": [";
+    for (int i = 0; i < (int)runs.size(); i++){
+        const SweepRun& run = runs[i];
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\"maxPatchSize\": " << run.options.maxPatchSize << ", \"cad_mode\": " << (run.options.cadMode ? "true" : "false")
+            << ", \"edge_flipping\": " << (run.options.edgeFlipping ? "true" : "false") << ", \"reject_inverted\": " << (run.options.rejectInverted ? "true" : "false")
+            << ", \"seeding\": \"" << seedingName(run.options.seeding) << "\", \"order\": \"" << orderName(run.options.order)
+            << "\", \"smooth_iterations\": " << run.options.smoothIterations << ", \"status\": \"" << Profiler::escape(run.status)
+            << "\", \"defects\": {\"before\": " << run.result.defectsBefore << ", \"after\": " << run.result.defectsAfter << "}, \"iterations\": "
+            << run.result.iterations << ", \"seconds\": " << run.result.seconds << "}";
+    }
+    out << "\n  ]\n";
+    out << "}\n";
+
+    return true;
+}
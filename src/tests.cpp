@@ -0,0 +1,899 @@
+#include <array>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <ultimaille/all.h>
+#include "animation.h"
+#include "bunin.h"
+#include "incremental.h"
+#include "mainLoop.h"
+#include "matrixEquations.h"
+#include "packedAttributes.h"
+#include "patchFinding.h"
+#include "reader.h"
+
+using namespace UM;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Behaviour tests of the pure functions of the remeshing, run by ctest one group at a time: tests <group> <meshes directory>
+
+inline int failures = 0;
+inline std::filesystem::path meshes = "meshes";
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)){ \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            failures++; \
+        } \
+    } while (0)
+
+inline void grid(Quads& m, int n){
+    // n x n quads in the plane z = 0, the vertex (i, j) at i + j*(n+1)
+    m.points.create_points((n+1)*(n+1));
+    for (int j = 0; j <= n; j++)
+        for (int i = 0; i <= n; i++)
+            m.points[i + j*(n+1)] = vec3(i, j, 0);
+    m.create_facets(n*n);
+    for (int j = 0; j < n; j++)
+        for (int i = 0; i < n; i++){
+            int f = i + j*n;
+            m.vert(f, 0) = i + j*(n+1);
+            m.vert(f, 1) = i+1 + j*(n+1);
+            m.vert(f, 2) = i+1 + (j+1)*(n+1);
+            m.vert(f, 3) = i + (j+1)*(n+1);
+        }
+    m.connect();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Side lengths and solvability
+
+inline void testSolvability(){
+    // the closed forms against the systems they stand for, every side length up to 8
+    for (int s = 0; s < 8*8*8*8*8; s++){
+        int segments[5];
+        int partSegments[10];
+        for (int i = 0, rest = s; i < 5; i++, rest /= 8)
+            segments[i] = rest % 8 + 1;
+
+        CHECK(isSolvable({segments[0], segments[1], segments[2]}) == bool(solve3equations(segments, partSegments)));
+        int a, b, c, d;
+        CHECK(isSolvable({segments[0], segments[1], segments[2], segments[3]}) == bool(solve4equations(segments, partSegments, a, b, c, d)));
+        CHECK(isSolvable({segments[0], segments[1], segments[2], segments[3], segments[4]}) == bool(solve5equations(segments, partSegments)));
+    }
+    CHECK(!isSolvable({7}));
+    CHECK(!isSolvable({1, 1}));
+    CHECK(!isSolvable({2, 2, 2, 2, 2, 2, 2}));
+}
+
+inline void testSegmentConstruction(){
+    // the side lengths from the corner positions, against the former pass over the rotated convexities
+    std::mt19937 random(1);
+    for (int test = 0; test < 10000; test++){
+        int n = 1 + random() % 20;
+        std::list<int> patch;
+        std::list<int> patchConvexity;
+        std::vector<int> segments;
+        for (int i = 0; i < n; i++){
+            int convexity = int(random() % 4) - 1;
+            patch.push_back(i);
+            patchConvexity.push_back(convexity);
+            if (convexity >= 1)
+                segments.push_back(i);
+        }
+        segmentConstruction(n, segments);
+        patchRotationRightToEdge(patch, patchConvexity);
+
+        std::vector<int> expected;
+        int edgeLength = 0;
+        for (auto it = std::next(patchConvexity.begin()); it != patchConvexity.end(); it++){
+            edgeLength++;
+            if (*it >= 1){
+                expected.push_back(edgeLength);
+                edgeLength = 0;
+            }
+        }
+        expected.push_back(edgeLength+1);
+        CHECK(segments == expected);
+    }
+}
+
+inline void testGetPatch(){
+    // a block of 3 x 2 facets in the middle of a grid is a rectangle of sides 3 and 2
+    Quads m;
+    grid(m, 8);
+    FacetStates fa(m);
+    for (int j = 3; j < 5; j++)
+        for (int i = 3; i < 6; i++)
+            fa[i + j*8] = 2;
+    int boundaryHe = -1;
+    for (int f = 0; f < m.nfacets() && boundaryHe == -1; f++)
+        for (int i = 0; i < 4 && boundaryHe == -1; i++)
+            if (fa[f] > 0 && fa[Halfedge(m, 4*f+i).opposite().facet()] == 0)
+                boundaryHe = 4*f+i;
+
+    std::list<int> patch;
+    std::list<int> patchConvexity;
+    std::vector<int> segments;
+    CHECK(getPatch(Halfedge(m, boundaryHe), fa, patch, patchConvexity, segments) == 1);
+    CHECK(patch.size() == 10);
+    CHECK(segments.size() == 4);
+    CHECK(segments[0] + segments[1] == 5 && segments[0]*segments[1] == 6 && segments[0] == segments[2] && segments[1] == segments[3]);
+
+    CornerFlags ca(m);
+    CHECK(postPatch(fa, m, patch, patchConvexity, segments, ca) == 4);
+    CHECK(patchConvexity.front() >= 1);
+
+    // a hard edge inside of the block drops it
+    ca[Halfedge(m, 4*(4 + 3*8) + 1)] = 1;
+    CHECK(getPatch(Halfedge(m, boundaryHe), fa, patch, patchConvexity, segments) == 1);
+    CHECK(postPatch(fa, m, patch, patchConvexity, segments, ca) == -1);
+}
+
+inline void testGetPatchHighValence(){
+    // the outline of a single facet at a vertex of valence 11 turns around it past MAX_VALENCE facets, and still comes back to its start
+    Quads m;
+    read_by_extension((meshes / "mambo/Medium/M8.mesh").string(), m);
+    CHECK(m.nfacets() > 0);
+    if (m.nfacets() == 0)
+        return;
+    m.connect();
+    std::vector<int> valence(m.nverts(), 0);
+    for (int c = 0; c < m.ncorners(); c++)
+        valence[m.facets[c]]++;
+    int f = -1;
+    for (int c = 0; c < m.ncorners() && f == -1; c++)
+        if (valence[m.facets[c]] > MAX_VALENCE + 1)
+            f = c / 4;
+    CHECK(f != -1);
+    if (f == -1)
+        return;
+
+    FacetStates fa(m);
+    fa[f] = 2;
+    std::list<int> patch;
+    std::list<int> patchConvexity;
+    std::vector<int> segments;
+    CHECK(getPatch(Halfedge(m, 4*f), fa, patch, patchConvexity, segments) == 1);
+    CHECK(patch.size() == 4);
+    CHECK(segments == std::vector<int>({1, 1, 1, 1}));
+}
+
+inline void testPatchOutline(){
+    // the outline kept through the additions of facets against the walk from scratch, on patches grown at random in a grid, some of them
+    // with holes, several pieces or reaching the border
+    Quads m;
+    grid(m, 12);
+    std::mt19937 random(1);
+    for (int test = 0; test < 200; test++){
+        FacetStates fa(m);
+        PatchOutline outline(m);
+        fa[random() % m.nfacets()] = 2;
+        outline.build(fa);
+        for (int expansion = 0; expansion < 15; expansion++){
+            std::vector<int> added;
+            for (int f = 0; f < m.nfacets(); f++){
+                if (fa[f] >= 1)
+                    continue;
+                bool next = false;
+                for (Halfedge he : Facet(m, f).iter_halfedges())
+                    next = next || (he.opposite() != -1 && fa[he.opposite().facet()] >= 1);
+                if ((next && random() % 3 == 0) || random() % 200 == 0)
+                    added.push_back(f);
+            }
+            for (int f : added)
+                fa[f] = 2;
+            outline.add(added, fa);
+
+            int start = -1;
+            for (int h = 0; h < m.ncorners() && start == -1; h++)
+                if (outline.onOutline(Halfedge(m, h), fa))
+                    start = h;
+            std::list<int> patch, fullPatch;
+            std::list<int> patchConvexity, fullConvexity;
+            std::vector<int> segments, fullSegments;
+            int walked = outline.walkSteps(Halfedge(m, start), fa, patch, patchConvexity, segments);
+            CHECK(walked == getPatch(Halfedge(m, start), fa, fullPatch, fullConvexity, fullSegments));
+            CHECK(walked == -1 || (patch == fullPatch && patchConvexity == fullConvexity && segments == fullSegments));
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Hexagons
+
+inline void testSolve6equations(){
+    // every solution splits each side in two parts, the second one being the first one of the side after the next. They are at least 1,
+    // but for a degenerate hexagon, whose parts of two opposite sides are 0
+    int degenerateHexagons = 0;
+    for (int s = 0; s < 6*6*6*6*6*6; s++){
+        int segments[6];
+        int partSegments[12];
+        for (int i = 0, rest = s; i < 6; i++, rest /= 6)
+            segments[i] = rest % 6 + 1;
+
+        int solved = solve6equations(segments, partSegments);
+        CHECK(bool(solved) == isSolvable(std::vector<int>(segments, segments+6)));
+        if (!solved)
+            continue;
+        int zeros = 0;
+        for (int i = 0; i < 6; i++){
+            CHECK(partSegments[2*i] >= 0 && partSegments[2*i+1] >= 0);
+            CHECK(partSegments[2*i] + partSegments[2*i+1] == segments[i]);
+            CHECK(partSegments[2*i+1] == partSegments[2*((i+2)%6)]);
+            zeros += partSegments[2*i] == 0;
+        }
+        CHECK(zeros == (solved == 2 ? 2 : 0));
+        degenerateHexagons += solved == 2;
+    }
+    CHECK(degenerateHexagons > 0);
+
+    int partSegments[12];
+    int regular[] = {2, 2, 2, 2, 2, 2};
+    CHECK(solve6equations(regular, partSegments) == 1);
+    // a part of 0 on a single side puts the centre on the outline, which has no remesh
+    int offCentre[] = {1, 2, 1, 2, 2, 2};
+    CHECK(!solve6equations(offCentre, partSegments));
+}
+
+inline int countDefects(Quads& m){
+    int defects = 0;
+    for (Vertex v : m.iter_vertices())
+        defects += getValence(v) != 4;
+    return defects;
+}
+
+inline void testDegenerateHexagon(){
+    // A block of 6 x 2 facets whose long sides have a corner 4 edges along them is a hexagon degenerating into the rectangle, remeshed as such
+    Quads m;
+    grid(m, 8);
+    FacetStates fa(m);
+    for (int j = 3; j < 5; j++)
+        for (int i = 1; i < 7; i++)
+            fa[i + j*8] = 2;
+    int boundaryHe = -1;
+    for (int f = 0; f < m.nfacets() && boundaryHe == -1; f++)
+        for (int i = 0; i < 4 && boundaryHe == -1; i++)
+            if (fa[f] > 0 && fa[Halfedge(m, 4*f+i).opposite().facet()] == 0)
+                boundaryHe = 4*f+i;
+    std::list<int> patch;
+    std::list<int> patchConvexity;
+    std::vector<int> segments;
+    CornerFlags ca(m);
+    CHECK(getPatch(Halfedge(m, boundaryHe), fa, patch, patchConvexity, segments) == 1);
+    CHECK(postPatch(fa, m, patch, patchConvexity, segments, ca) == 4);
+
+    std::vector<int> hexagon;
+    auto convexity = patchConvexity.begin();
+    for (int side : segments){
+        if (side == 6){
+            hexagon.insert(hexagon.end(), {4, 2});
+            *std::next(convexity, 4) = 1;
+        } else
+            hexagon.push_back(side);
+        std::advance(convexity, side);
+    }
+    int partSegments[12];
+    CHECK(hexagon.size() == 6 && solve6equations(hexagon.data(), partSegments) == 2);
+
+    Triangles mTri = quand2tri(m);
+    BVH bvh(mTri);
+    CHECK(remeshingPatch(patch, patchConvexity, hexagon, m, fa, 0, bvh));
+    m.compact(true);
+    CHECK(m.nfacets() == 64);
+    CHECK(countDefects(m) == 0);
+}
+
+inline void testHexagonDefects(const std::string& model, bool cadMode){
+    // Remeshes the six sided patches of a mesh one after the other, the valence 6 vertex at their centre never leaving more defects than
+    // the remesh removes
+    Quads m;
+    read_by_extension((meshes / model).string(), m);
+    CHECK(m.nfacets() > 0);
+    if (m.nfacets() == 0)
+        return;
+    m.connect();
+    CornerFlags ca(m);
+    FacetStates fa(m);
+    if (cadMode)
+        markHardEdges(m, ca);
+    Triangles mTri = quand2tri(m);
+    BVH bvh(mTri);
+
+    int hexagons = 0;
+    bool remeshed = true;
+    while (remeshed){
+        remeshed = false;
+        DefectField field(m, ca);
+        for (Vertex v : m.iter_vertices()){
+            if (getValence(v) == 4)
+                continue;
+            fa.fill(0);
+            std::list<int> patch;
+            std::list<int> patchConvexity;
+            std::vector<int> segments;
+            PatchOutline outline(m);
+            int edgeCount = initialPatchConstruction(v, field, fa, patch, patchConvexity, segments, m, ca, outline);
+            for (int i = 0; i < 20 && edgeCount != -1 && edgeCount != 6 && countFacetsInsidePatch(fa) < 500; i++)
+                edgeCount = expandPatch(patch, fa, m, patchConvexity, segments, ca, outline);
+            if (edgeCount != 6)
+                continue;
+
+            int before = countDefects(m);
+            if (!remeshingPatch(patch, patchConvexity, segments, m, fa, v, bvh))
+                continue;
+            m.compact(true);
+            CHECK(countDefects(m) <= before);
+            hexagons++;
+            remeshed = true;
+            break;
+        }
+    }
+    CHECK(hexagons > 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Open meshes
+
+inline std::vector<std::array<double, 6>> borderEdges(Quads& m){
+    // the ends of the halfedges without an opposite, sorted, to be compared between meshes numbered differently
+    std::vector<std::array<double, 6>> edges;
+    for (Halfedge he : m.iter_halfedges())
+        if (he.opposite() == -1){
+            vec3 a = he.from().pos();
+            vec3 b = he.to().pos();
+            edges.push_back({a.x, a.y, a.z, b.x, b.y, b.z});
+        }
+    std::sort(edges.begin(), edges.end());
+    return edges;
+}
+
+inline void testOpenMesh(){
+    // The vertices on a border count as regular ones, so the corners of an open grid are no defects, and a mesh cut open is remeshed
+    // inside without its border moving
+    Quads square;
+    grid(square, 4);
+    CHECK(countDefects(square) == 0);
+
+    Quads m;
+    read_by_extension((meshes / "mambo/Simple/S1.mesh").string(), m);
+    CHECK(m.nfacets() > 0);
+    if (m.nfacets() == 0)
+        return;
+    double middle = 0;
+    for (int v = 0; v < m.nverts(); v++)
+        middle += m.points[v].x / m.nverts();
+    std::vector<bool> cut(m.nfacets(), false);
+    for (int f = 0; f < m.nfacets(); f++)
+        cut[f] = m.points[m.vert(f, 0)].x > middle;
+    m.delete_facets(cut);
+    m.delete_isolated_vertices();
+    m.connect();
+    std::vector<std::array<double, 6>> border = borderEdges(m);
+    int defects = countDefects(m);
+    CHECK(!border.empty() && defects > 0);
+
+    FacetStates fa(m);
+    FacetFlags remeshed(m);
+    CornerFlags ca(m);
+    Triangles mTri = quand2tri(m);
+    BVH bvh(mTri);
+    mainLoop(m, bvh, fa, remeshed, ca);
+    CHECK(countDefects(m) < defects);
+    CHECK(borderEdges(m) == border);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Packed attributes
+
+inline void testPackedAttributes(){
+    // values across the word boundaries, with the bits past the last value kept at 0 by fill and resize
+    Quads m;
+    grid(m, 6);
+    FacetStates states(m);
+    CHECK(states.size() == 36 && states.bytes() == 2*sizeof(uint64_t));
+    for (int f = 0; f < 36; f++)
+        states[f] = f % 4;
+    bool same = true;
+    for (int f = 0; f < 36; f++)
+        same = same && states[f] == f % 4;
+    CHECK(same);
+    states.fill(3);
+    CHECK(states[35] == 3 && (states.ptr->words[1] >> (2*4)) == 0);
+
+    // forEachNonZero visits the values set, in order, and stops when asked to
+    FacetFlags flags(m);
+    flags[1] = 1;
+    flags[33] = 1;
+    std::vector<int> visited;
+    CHECK(forEachNonZero(flags, [&](int f, int value){ visited.push_back(f); return value == 1; }));
+    CHECK((visited == std::vector<int>{1, 33}));
+    visited.clear();
+    CHECK(!forEachNonZero(flags, [&](int f, int){ visited.push_back(f); return false; }));
+    CHECK(visited.size() == 1);
+
+    // the values follow their facets, and the corners of these facets, when the mesh deletes some of them
+    CornerFlags corners(m);
+    for (int f = 0; f < 36; f++){
+        states[f] = f % 3;
+        corners[4*f + 2] = f % 2;
+    }
+    std::vector<bool> kill(36, false);
+    for (int f = 0; f < 36; f += 5)
+        kill[f] = true;
+    m.disconnect();
+    m.delete_facets(kill);
+    CHECK(m.nfacets() == 28 && states.size() == 28 && corners.size() == 4*28);
+    same = true;
+    for (int f = 0, kept = 0; f < 36; f++)
+        if (!kill[f]){
+            same = same && states[kept] == f % 3 && corners[4*kept + 2] == f % 2 && corners[4*kept] == 0;
+            kept++;
+        }
+    CHECK(same);
+
+    // permute by blocks of 4, as for the corners of the reordered facets, and the int attributes of the library in and out
+    std::vector<int> order(28);
+    for (int f = 0; f < 28; f++)
+        order[f] = 27 - f;
+    std::vector<uint64_t> before = corners.ptr->words;
+    CornerAttribute<int> ints(m, 0);
+    storeAttribute(corners, ints);
+    permute(*corners.ptr, order, 4);
+    same = true;
+    for (int f = 0; f < 28; f++)
+        for (int i = 0; i < 4; i++)
+            same = same && corners[4*f + i] == ints[4*(27 - f) + i];
+    CHECK(same);
+    loadAttribute(corners, ints);
+    CHECK(corners.ptr->words == before);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reordering
+
+inline void testCurveKeys(){
+    // on a grid of 8 cells per side, each curve numbers the cells once, and the Hilbert curve only goes from a cell to one next to it
+    const int bits = 3;
+    const int n = 1 << bits;
+    std::vector<std::array<int, 3>> byMorton(n*n*n, {-1, -1, -1});
+    std::vector<std::array<int, 3>> byHilbert(n*n*n, {-1, -1, -1});
+    bool inRange = true;
+    for (int i = 0; i < n*n*n; i++){
+        uint32_t x[3] = {uint32_t(i % n), uint32_t(i / n % n), uint32_t(i / (n*n))};
+        uint64_t morton = mortonKey(x, bits);
+        uint64_t hilbert = hilbertKey(x, bits);
+        inRange = inRange && morton < byMorton.size() && hilbert < byHilbert.size();
+        if (!inRange)
+            break;
+        byMorton[morton] = {i % n, i / n % n, i / (n*n)};
+        byHilbert[hilbert] = byMorton[morton];
+    }
+    CHECK(inRange);
+    CHECK(std::find(byMorton.begin(), byMorton.end(), std::array<int, 3>{-1, -1, -1}) == byMorton.end());
+    CHECK(std::find(byHilbert.begin(), byHilbert.end(), std::array<int, 3>{-1, -1, -1}) == byHilbert.end());
+    int steps = 0;
+    for (int k = 1; k < n*n*n; k++)
+        steps += std::abs(byHilbert[k][0] - byHilbert[k-1][0]) + std::abs(byHilbert[k][1] - byHilbert[k-1][1]) + std::abs(byHilbert[k][2] - byHilbert[k-1][2]) == 1;
+    CHECK(steps == n*n*n - 1);
+    uint32_t x[3] = {1, 0, 0};
+    CHECK(mortonKey(x, 1) == 4);
+}
+
+inline void testReorder(){
+    // the attributes bound to the mesh follow its facets, corners and vertices, of any type the reordering knows
+    Quads m;
+    grid(m, 12);
+    std::vector<int> before(m.facets.begin(), m.facets.end());
+    int nverts = m.nverts();
+    FacetAttribute<int> facetIds(m, 0);
+    CornerAttribute<int> cornerIds(m, 0);
+    PointAttribute<int> vertexIds(m.points, 0);
+    PointAttribute<vec3> positions(m.points);
+    FacetFlags odd(m);
+    for (int f = 0; f < m.nfacets(); f++){
+        facetIds[f] = f;
+        odd[f] = f % 2;
+    }
+    for (int c = 0; c < m.ncorners(); c++)
+        cornerIds[c] = c;
+    for (int v = 0; v < m.nverts(); v++){
+        vertexIds[v] = v;
+        positions[v] = m.points[v];
+    }
+
+    CHECK(reorder(m, CurveOrder::hilbert));
+    CHECK(m.conn && m.ncorners() == (int)before.size() && m.nverts() == nverts);
+    CHECK(!std::equal(before.begin(), before.end(), m.facets.begin()));
+    bool same = true;
+    for (int f = 0; f < m.nfacets(); f++){
+        same = same && odd[f] == facetIds[f] % 2;
+        for (int i = 0; i < 4; i++){
+            int c = 4*f + i;
+            same = same && cornerIds[c] == 4*facetIds[f] + i && vertexIds[m.vert(f, i)] == before[4*facetIds[f] + i];
+        }
+    }
+    for (int v = 0; v < m.nverts(); v++)
+        same = same && positions[v].x == m.points[v].x && positions[v].y == m.points[v].y;
+    CHECK(same);
+
+    // and the mesh keeps its order when one can't follow
+    FacetAttribute<float> unknown(m, 0);
+    std::vector<int> facets(m.facets.begin(), m.facets.end());
+    CHECK(!reorder(m, CurveOrder::morton));
+    CHECK(std::equal(facets.begin(), facets.end(), m.facets.begin()));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cached meshes
+
+inline void testConnectivity(){
+    // the corner lists built in parallel are the ones of connect(), on a closed mesh and on an open grid, and the opposites the ones of
+    // ultimaille. An edge shared by three facets is non manifold
+    Quads closed;
+    read_by_extension((meshes / "mambo/Medium/M1.mesh").string(), closed);
+    Quads open;
+    grid(open, 5);
+    open.disconnect();
+    for (Quads* m : {&closed, &open}){
+        CHECK(m->nfacets() > 0);
+        if (m->nfacets() == 0)
+            continue;
+        Quads reference;
+        reference.points.create_points(m->nverts());
+        for (int v = 0; v < m->nverts(); v++)
+            reference.points[v] = m->points[v];
+        reference.create_facets(m->nfacets());
+        reference.facets = m->facets;
+        reference.connect();
+        std::vector<int> opposites;
+        CHECK(connectParallel(*m, &opposites) == 0);
+        CHECK(m->conn->c2f == reference.conn->c2f && m->conn->c2c == reference.conn->c2c && m->conn->v2c == reference.conn->v2c);
+        CHECK(m->conn->active == reference.conn->active);
+        int same = 0;
+        for (Halfedge he : reference.iter_halfedges())
+            same += opposites[he] == he.opposite();
+        CHECK(same == reference.ncorners());
+    }
+
+    Quads fan;
+    fan.points.create_points(8);
+    fan.create_facets(3);
+    for (int f = 0; f < 3; f++){
+        fan.vert(f, 0) = 0;
+        fan.vert(f, 1) = 1;
+        fan.vert(f, 2) = 2 + 2*f;
+        fan.vert(f, 3) = 3 + 2*f;
+    }
+    std::vector<int> opposites;
+    CHECK(connectParallel(fan, &opposites) == 1);
+    CHECK(opposites[fan.facet_corner(0, 0)] == -1);
+}
+
+inline void testCache(){
+    // the mesh, its connectivity and its hard edges read back from the cache as they were made from the file, and a damaged cache
+    // or one that can't be written left aside
+    std::string source = (meshes / "mambo/Medium/M1.mesh").string();
+    std::filesystem::path directory = std::filesystem::temp_directory_path() / "bunin_tests_cache";
+    std::filesystem::remove_all(directory);
+    Quads read;
+    CornerFlags readHardEdges(read);
+    CHECK(readInput(read, source, directory.string(), &readHardEdges));
+    CHECK(read.nfacets() > 0 && read.conn);
+    if (read.nfacets() == 0)
+        return;
+    std::string file = cacheFile(directory.string(), source);
+    CHECK(std::filesystem::exists(file));
+
+    Quads cached;
+    CornerFlags cachedHardEdges(cached);
+    CHECK(readCache(cached, file, source, &cachedHardEdges));
+    CHECK(cached.nverts() == read.nverts() && cached.facets == read.facets && cached.conn);
+    bool same = true;
+    for (int v = 0; v < read.nverts(); v++)
+        same = same && cached.points[v].x == read.points[v].x && cached.points[v].y == read.points[v].y && cached.points[v].z == read.points[v].z;
+    CHECK(same);
+    CHECK(cached.conn->c2f == read.conn->c2f && cached.conn->c2c == read.conn->c2c && cached.conn->v2c == read.conn->v2c);
+    CHECK(cached.conn->active == read.conn->active);
+    CHECK(cachedHardEdges.ptr->words == readHardEdges.ptr->words);
+    CHECK(countDefects(cached) == countDefects(read));
+    int opposites = 0;
+    for (Halfedge he : cached.iter_halfedges())
+        opposites += he.opposite() == Halfedge(read, he).opposite();
+    CHECK(opposites == cached.ncorners());
+
+    // the selection of a run is cached apart, and only read back with it
+    std::vector<bool> selection(read.nfacets(), false);
+    for (int f = 0; f < read.nfacets(); f += 3)
+        selection[f] = true;
+    std::string selectionFile = cacheFile(directory.string(), source, "selection\n");
+    CHECK(selectionFile != file);
+    CHECK(writeCache(read, selectionFile, source, readHardEdges, &selection));
+    Quads selected;
+    std::vector<bool> cachedSelection;
+    CHECK(readCache(selected, selectionFile, source, nullptr, &cachedSelection) && cachedSelection == selection);
+    Quads unselected;
+    CHECK(!readCache(unselected, selectionFile, source) && !readCache(unselected, file, source, nullptr, &cachedSelection));
+    std::filesystem::remove(selectionFile);
+
+    // a cache written with another commit of ultimaille, a corner past the mesh, then a cache cut short
+    std::vector<char> bytes(std::filesystem::file_size(file));
+    std::ifstream(file, std::ios::binary).read(bytes.data(), bytes.size());
+    bytes[offsetof(CacheHeader, ultimaille)] ^= 1;
+    std::ofstream(file, std::ios::binary).write(bytes.data(), bytes.size());
+    Quads otherCommit;
+    CHECK(!readCache(otherCommit, file, source));
+    bytes[offsetof(CacheHeader, ultimaille)] ^= 1;
+    int past = read.ncorners();
+    std::memcpy(bytes.data() + sizeof(CacheHeader) + read.nverts()*sizeof(vec3) + 2*read.ncorners()*sizeof(int), &past, sizeof(int));
+    std::ofstream(file, std::ios::binary).write(bytes.data(), bytes.size());
+    Quads damaged;
+    CHECK(!readCache(damaged, file, source));
+    CHECK(damaged.nverts() == 0 && damaged.nfacets() == 0 && !damaged.conn);
+    std::filesystem::resize_file(file, bytes.size() - 1);
+    CHECK(!readCache(damaged, file, source));
+
+    // the cache can't replace a directory, and the file written for it is removed
+    std::filesystem::remove(file);
+    std::filesystem::create_directories(std::filesystem::path(file) / "taken");
+    CHECK(!writeCache(read, file, source, readHardEdges));
+    int files = 0;
+    for (auto& entry : std::filesystem::directory_iterator(directory))
+        files += entry.path().string() != file;
+    CHECK(files == 0);
+    std::filesystem::remove_all(directory);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Incremental re-run
+
+inline std::vector<std::array<double, 12>> facetCorners(Quads& m){
+    // the corners of the facets, sorted, to be compared between meshes numbered differently
+    std::vector<std::array<double, 12>> corners;
+    for (int f = 0; f < m.nfacets(); f++){
+        std::array<double, 12> facet;
+        for (int i = 0; i < 4; i++)
+            for (int d = 0; d < 3; d++)
+                facet[3*i + d] = m.points[m.vert(f, i)][d];
+        corners.push_back(facet);
+    }
+    std::sort(corners.begin(), corners.end());
+    return corners;
+}
+
+inline void testUpdate(){
+    // An unchanged input gives the previous result back, and an edit moving a vertex or taking a facet out keeps the previous result away
+    // from it, no facet being left over the hole
+    Quads previousInput;
+    read_by_extension((meshes / "mambo/Simple/S1.mesh").string(), previousInput);
+    CHECK(previousInput.nfacets() > 0);
+    if (previousInput.nfacets() == 0)
+        return;
+    Quads previousOutput;
+    bunin::copy(previousInput, previousOutput);
+    bunin::Options options;
+    bunin::remesh(previousOutput, options);
+    std::vector<std::array<double, 12>> previous = facetCorners(previousOutput);
+
+    Quads same;
+    bunin::copy(previousInput, same);
+    bunin::Result unchanged = bunin::update(previousInput, previousOutput, same, options);
+    CHECK(facetCorners(same) == previous);
+    CHECK(unchanged.defectsBefore == unchanged.defectsAfter);
+
+    // a vertex moved off the surface by a hundredth of the size of the mesh
+    vec3 low = previousInput.points[0];
+    vec3 high = low;
+    for (int v = 0; v < previousInput.nverts(); v++)
+        for (int d = 0; d < 3; d++){
+            low[d] = std::min(low[d], previousInput.points[v][d]);
+            high[d] = std::max(high[d], previousInput.points[v][d]);
+        }
+    double size = (high - low).norm();
+    Quads edited;
+    bunin::copy(previousInput, edited);
+    vec3 moved = edited.points[edited.vert(0, 0)];
+    vec3 normal = cross(edited.points[edited.vert(0, 2)] - edited.points[edited.vert(0, 0)], edited.points[edited.vert(0, 3)] - edited.points[edited.vert(0, 1)]);
+    edited.points[edited.vert(0, 0)] += normal.normalized() * (size / 100);
+    bunin::Result result = bunin::update(previousInput, previousOutput, edited, options);
+    CHECK(result.defectsAfter <= result.defectsBefore);
+    CHECK(facetCorners(edited) != previous);
+    auto keptAwayFrom = [&](Quads& updated, const vec3& change){
+        // the facets of the previous result far from the change are all in the updated one
+        std::vector<std::array<double, 12>> kept = facetCorners(updated);
+        int far = 0;
+        int farKept = 0;
+        for (const std::array<double, 12>& facet : previous){
+            bool isFar = true;
+            for (int i = 0; i < 4; i++)
+                isFar = isFar && (vec3(facet[3*i], facet[3*i + 1], facet[3*i + 2]) - change).norm() > size / 4;
+            if (!isFar)
+                continue;
+            far++;
+            farKept += std::binary_search(kept.begin(), kept.end(), facet);
+        }
+        return far > 0 && farKept == far;
+    };
+    CHECK(keptAwayFrom(edited, moved));
+
+    // the facets around one taken out, the vertices being numbered again
+    Quads cut;
+    bunin::copy(previousInput, cut);
+    vec3 hole = facetCentroid(cut, 0);
+    double radius = size / 20;
+    std::vector<bool> taken(cut.nfacets(), false);
+    for (int f = 0; f < cut.nfacets(); f++)
+        for (int i = 0; i < 4; i++)
+            taken[f] = taken[f] || (cut.points[cut.vert(f, i)] - hole).norm() < radius;
+    cut.delete_facets(taken);
+    cut.delete_isolated_vertices();
+    bunin::Result cutResult = bunin::update(previousInput, previousOutput, cut, options);
+    CHECK(cutResult.defectsAfter <= cutResult.defectsBefore);
+    CHECK(cut.nfacets() < previousOutput.nfacets());
+    CHECK(keptAwayFrom(cut, hole));
+    for (int f = 0; f < cut.nfacets(); f++)
+        CHECK((facetCentroid(cut, f) - hole).norm() > radius / 2);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Animation log
+
+inline void testReplaceFacetsInPlace(){
+    // a 2 x 2 block of a grid replaced by 4 quads around a new centre, in place, against replaceFacets and a new connectivity: the same
+    // opposites on the active facets, the old centre left without facets, and the same mesh once compacted
+    Quads m;
+    grid(m, 6);
+    m.connect();
+    Quads replaced;
+    bunin::copy(m, replaced);
+
+    std::vector<int> killed = {2 + 2*6, 3 + 2*6, 2 + 3*6, 3 + 3*6};
+    std::vector<bool> toKill(m.nfacets(), false);
+    for (int f : killed)
+        toKill[f] = true;
+    int centre = m.nverts();
+    std::vector<vec3> points = {vec3(3.2, 2.9, 0)};
+    std::vector<int> quads = {2 + 2*7, 3 + 2*7, centre, 2 + 3*7,   3 + 2*7, 4 + 2*7, 4 + 3*7, centre,
+                              centre, 4 + 3*7, 4 + 4*7, 3 + 4*7,   2 + 3*7, centre, 3 + 4*7, 2 + 4*7};
+
+    replaceFacetsInPlace(m, killed, points, quads);
+    replaceFacets(replaced, toKill, points, quads);
+    replaced.connect();
+
+    std::vector<int> facetIds, vertexIds;
+    int nbFacets, nbVertices;
+    compactedIds(m, facetIds, vertexIds, nbFacets, nbVertices);
+    CHECK(nbFacets == replaced.nfacets() && nbVertices == replaced.nverts());
+    CHECK(Vertex(m, 3 + 3*7).halfedge() == -1 && getValence(Vertex(m, 3 + 3*7)) == 4);
+    for (int f = 0; f < m.nfacets(); f++){
+        if (!m.conn->active[f])
+            continue;
+        for (int i = 0; i < 4; i++){
+            Halfedge he(m, 4*f + i);
+            Halfedge expected = Halfedge(replaced, 4*facetIds[f] + i).opposite();
+            CHECK(he.opposite() == -1 ? expected == -1 : 4*facetIds[he.opposite().facet()] + (he.opposite() % 4) == expected);
+            CHECK(vertexIds[he.from()] == replaced.vert(facetIds[f], i));
+        }
+    }
+
+    m.compact(true);
+    CHECK(m.facets == replaced.facets);
+    for (int v = 0; v < m.nverts(); v++)
+        CHECK((m.points[v] - replaced.points[v]).norm2() == 0);
+}
+
+inline void testVarints(){
+    // the values around each byte boundary, read back in the order they were written
+    std::vector<uint64_t> values = {0, 1, 127, 128, 255, 16383, 16384, (1ull << 31) - 1, 1ull << 35, ~0ull};
+    std::string bytes;
+    for (uint64_t value : values)
+        writeVarint(bytes, value);
+    std::istringstream in(bytes);
+    for (uint64_t value : values){
+        uint64_t read = 0;
+        CHECK(readVarint(in, read) && read == value);
+    }
+    uint64_t read;
+    CHECK(!readVarint(in, read));
+
+    std::vector<vec3> points = {{0, 1, 2}, {-3.5, 4e10, 1e-12}};
+    std::vector<int> ids = {0, 5, 300, 1 << 20};
+    bytes.clear();
+    writePoints(bytes, points);
+    writeIds(bytes, ids.data(), ids.size());
+    in = std::istringstream(bytes);
+    std::vector<vec3> readPointsBack;
+    std::vector<int> readIdsBack;
+    CHECK(readPoints(in, readPointsBack, bytes.size()) && readIds(in, readIdsBack, bytes.size()));
+    CHECK(readIdsBack == ids && readPointsBack.size() == 2 && readPointsBack[1].x == -3.5 && readPointsBack[1].y == 4e10);
+
+    // a count larger than the bytes left is rejected before allocating anything, as is an id past an int
+    bytes.clear();
+    writeVarint(bytes, 1ull << 40);
+    in = std::istringstream(bytes);
+    CHECK(!readPoints(in, readPointsBack, bytes.size()));
+    in = std::istringstream(bytes);
+    CHECK(!readIds(in, readIdsBack, bytes.size()));
+    bytes.clear();
+    writeVarint(bytes, 1);
+    writeVarint(bytes, 1ull << 40);
+    in = std::istringstream(bytes);
+    CHECK(!readIds(in, readIdsBack, bytes.size()));
+}
+
+inline void testAnimationLog(){
+    // a logged run replayed frame by frame gives the remeshed mesh, and the same log cut short is an error rather than an end
+    Quads m;
+    read_by_extension((meshes / "mambo/Basic/B2.mesh").string(), m);
+    CHECK(m.nfacets() > 0);
+    if (m.nfacets() == 0)
+        return;
+    m.connect();
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "bunin_tests.anim";
+    FacetStates fa(m);
+    FacetFlags remeshed(m);
+    CornerFlags ca(m);
+    Triangles mTri = quand2tri(m);
+    BVH bvh(mTri);
+    LoopSettings settings;
+    settings.animationPath = path.string();
+    settings.edgeFlipping = false;
+    mainLoop(m, bvh, fa, remeshed, ca, settings);
+
+    Quads replayed;
+    AnimationReader reader;
+    CHECK(reader.open(path.string(), replayed));
+    while (reader.next(replayed));
+    CHECK(reader.error.empty());
+    CHECK(reader.frame > 0);
+    CHECK(replayed.nverts() == m.nverts() && replayed.nfacets() == m.nfacets());
+    CHECK(std::equal(m.facets.begin(), m.facets.end(), replayed.facets.begin()));
+
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+    Quads truncated;
+    AnimationReader truncatedReader;
+    CHECK(truncatedReader.open(path.string(), truncated));
+    while (truncatedReader.next(truncated));
+    CHECK(!truncatedReader.error.empty());
+    CHECK(truncatedReader.frame == reader.frame - 1);
+    std::filesystem::remove(path);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char* argv[]) {
+    std::vector<std::pair<std::string, std::function<void()>>> groups = {
+        {"solvability", [](){ testSolvability(); testSegmentConstruction(); testGetPatch(); testGetPatchHighValence(); testPatchOutline(); }},
+        {"hexagons", [](){ testSolve6equations(); testDegenerateHexagon(); testHexagonDefects("mambo/Simple/S1.mesh", false); testHexagonDefects("mambo/Basic/B2.mesh", true); }},
+        {"borders", [](){ testOpenMesh(); }},
+        {"packed", [](){ testPackedAttributes(); }},
+        {"reordering", [](){ testCurveKeys(); testReorder(); }},
+        {"connectivity", [](){ testConnectivity(); }},
+        {"cache", [](){ testCache(); }},
+        {"update", [](){ testUpdate(); }},
+        {"animation", [](){ testReplaceFacetsInPlace(); testVarints(); testAnimationLog(); }},
+    };
+
+    verbose = false;
+    std::string only = argc > 1 ? argv[1] : "";
+    if (argc > 2)
+        meshes = argv[2];
+    for (auto& [name, test] : groups){
+        if (!only.empty() && name != only)
+            continue;
+        int before = failures;
+        test();
+        std::cout << (failures == before ? "ok     " : "FAILED ") << name << std::endl;
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "profiling.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Background writer
+
+struct BackgroundWriter {
+    // Writes the files on a thread of its own, so the remeshing doesn't wait on the disk. The jobs are done in the order they were pushed,
+    // the thread being started by the first one. The queue is bounded so the pending snapshots don't pile up in memory: when it is full, push
+    // waits for the oldest job to be done, which is the only way not to lose any of them, as an animation frame can't be skipped
+    int capacity;
+    std::deque<std::function<void()>> queue;
+    bool busy = false;     // a job has been taken from the queue and isn't done
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread thread;
+
+    long jobs = 0;
+    long waits = 0;         // pushes that found the queue full
+    double waitSeconds = 0; // time spent by them waiting
+    std::string error;      // first error of a job, empty if none
+
+    explicit BackgroundWriter(int capacity = 64) : capacity(std::max(1, capacity)) {}
+
+    BackgroundWriter(const BackgroundWriter&) = delete;
+    BackgroundWriter& operator=(const BackgroundWriter&) = delete;
+
+    ~BackgroundWriter(){
+        // flushes before stopping, so nothing pushed is lost
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    void push(std::function<void()> job){
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!thread.joinable())
+            thread = std::thread([this](){ run(); });
+        if ((int)queue.size() >= capacity){
+            auto start = std::chrono::steady_clock::now();
+            changed.wait(lock, [this](){ return (int)queue.size() < capacity; });
+            waits++;
+            waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        queue.push_back(std::move(job));
+        jobs++;
+        lock.unlock();
+        changed.notify_all();
+    }
+
+    bool flush(){
+        // Waits for all the jobs pushed so far to be done. False if one of them failed
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this](){ return queue.empty() && !busy; });
+        return error.empty();
+    }
+
+    void run(){
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true){
+            changed.wait(lock, [this](){ return !queue.empty() || stopping; });
+            if (queue.empty())
+                return;
+
+            std::function<void()> job = std::move(queue.front());
+            queue.pop_front();
+            busy = true;
+            lock.unlock();
+            changed.notify_all();
+
+            std::string failure;
+            try {
+                ScopedTimer timer("background write");
+                job();
+            } catch (std::exception& e) {
+                failure = e.what();
+            }
+
+            lock.lock();
+            busy = false;
+            if (!failure.empty() && error.empty())
+                error = failure;
+            changed.notify_all();
+        }
+    }
+};